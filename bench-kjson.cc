@@ -0,0 +1,120 @@
+/*
+ * bench-kjson.cc
+ *
+ * Copyright 2019-2020 Franz Brauße <brausse@informatik.uni-trier.de>
+ *
+ * This file is part of kjson.
+ * See the LICENSE file for terms of distribution.
+ */
+
+/* Compares the error policies of kjson.hh, that is, kjson::json (throwing),
+ * kjson::json_opt (std::optional) and kjson::json_exp (expected), on lookups
+ * of keys in objects where a configurable share of them is absent.  Each
+ * object of the generated document has -k keys; for every object the -k keys
+ * are looked up together with as many absent ones as needed to reach the miss
+ * ratios listed in the output.  Timings are the best of -r rounds in
+ * nanoseconds per lookup.
+ */
+
+#include <chrono>
+#include <cstdio>	/* printf() */
+#include <cstdlib>	/* strtoul(), exit() */
+#include <string>
+#include <vector>
+#include <unistd.h>	/* getopt() */
+
+#include "kjson.hh"
+
+#define DIE(code,...) do { fprintf(stderr, __VA_ARGS__); exit(code); } while (0)
+
+using clk = std::chrono::steady_clock;
+
+static std::string gen(size_t n, size_t k)
+{
+	std::string s = "[";
+	for (size_t i=0; i<n; i++) {
+		s += i ? ",{" : "{";
+		for (size_t j=0; j<k; j++)
+			s += (j ? ",\"k" : "\"k") + std::to_string(j) + "\":" +
+			     std::to_string(i+j);
+		s += "}";
+	}
+	return s + "]";
+}
+
+/* time per call of f(i, key) for all i < n and all keys; f returns whether
+ * the key was found */
+template <typename F>
+static double run(const std::vector<std::string> &keys, size_t n, unsigned rounds,
+                  size_t &found, F &&f)
+{
+	double best = 0;
+	for (unsigned r=0; r<rounds; r++) {
+		found = 0;
+		auto t0 = clk::now();
+		for (size_t i=0; i<n; i++)
+			for (const std::string &k : keys)
+				found += f(i, k);
+		double t = std::chrono::duration<double,std::nano>(clk::now() - t0).count();
+		if (!r || t < best)
+			best = t;
+	}
+	return best / (n * keys.size());
+}
+
+int main(int argc, char **argv)
+{
+	size_t n = 10000, k = 8;
+	unsigned rounds = 5;
+	for (int opt; (opt = getopt(argc, argv, ":hk:n:r:")) != -1;)
+		switch (opt) {
+		case 'h': DIE(1,"usage: %s [-k KEYS] [-n OBJECTS] [-r ROUNDS]\n",
+			      argv[0]);
+		case 'k': k = strtoul(optarg, NULL, 10); break;
+		case 'n': n = strtoul(optarg, NULL, 10); break;
+		case 'r': rounds = strtoul(optarg, NULL, 10); break;
+		case ':': DIE(1,"error: option '-%c' requires a parameter\n",
+			      optopt);
+		case '?': DIE(1,"error: unknown option '-%c'\n", optopt);
+		}
+	if (!n || !k || !rounds)
+		DIE(1,"error: parameters must be positive\n");
+
+	std::string doc = gen(n, k);
+	kjson::json a = kjson::json::parse(doc);
+	kjson::json_opt ao = *kjson::json_opt::parse(doc);
+	kjson::json_exp ae = *kjson::json_exp::parse(doc);
+
+	printf("%5s %10s %10s %10s\n", "miss", "json", "json_opt", "json_exp");
+	for (unsigned miss : { 0, 10, 50, 90 }) {
+		std::vector<std::string> keys;
+		for (size_t j=0; j<k; j++)
+			keys.push_back("k" + std::to_string(j));
+		size_t absent = miss ? (k * miss + 100 - miss - 1) / (100 - miss) : 0;
+		for (size_t j=0; j<absent; j++)
+			keys.push_back("x" + std::to_string(j));
+
+		size_t f0, f1, f2;
+		double t0 = run(keys, n, rounds, f0, [&](size_t i, const std::string &key){
+			try {
+				a[i][key];
+				return true;
+			} catch (const kjson::detail::opt_throw::exception &) {
+				return false;
+			}
+		});
+		double t1 = run(keys, n, rounds, f1, [&](size_t i, const std::string &key){
+			auto e = ao[i];
+			return e && (*e)[key].has_value();
+		});
+		double t2 = run(keys, n, rounds, f2, [&](size_t i, const std::string &key){
+			auto e = ae[i];
+			return e && (*e)[key].has_value();
+		});
+		if (f0 != n * k || f1 != f0 || f2 != f0)
+			DIE(2,"error: lookups disagree: %zu, %zu, %zu\n", f0, f1, f2);
+		printf("%4zu%% %10.1f %10.1f %10.1f\n",
+		       100 * absent / keys.size(), t0, t1, t2);
+	}
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * check-kjson.c
+ *
+ * Copyright 2019-2020 Franz Brauße <brausse@informatik.uni-trier.de>
+ *
+ * This file is part of kjson.
+ * See the LICENSE file for terms of distribution.
+ */
+
+/* Compiled by 'make check': a translation unit using kjson.c through
+ * KJSON_IMPLEMENTATION while defining some of the names kjson.c uses
+ * internally. It only compiles as long as kjson.c renames or removes them;
+ * 'make check' then verifies using nm(1) that all other symbols are kjson's. */
+
+#define KJSON_IMPLEMENTATION
+#include "kjson.h"
+
+struct elem {
+	int n;
+};
+
+static int top, compact;
+
+static bool fail(const struct elem *e)
+{
+	return e->n != top + compact;
+}
+
+static bool validate(const char *s)
+{
+	struct kjson_parser p = { .s = (char *)s };
+	struct kjson_value v;
+	bool r = kjson_parse(&p, &v);
+	if (r)
+		kjson_value_fini(&v);
+	return r;
+}
+
+#define COLD
+#define PROBE
+#define B64
+#define CONCAT
+#define ELEM_INIT
+
+int main(void)
+{
+	char buf[] = "[1,{\"a\":\"b\"}]";
+	struct elem e = { 0 };
+	return !validate(buf) || fail(&e);
+}
@@ -0,0 +1,522 @@
+/*
+ * kjson-gen.c
+ *
+ * Copyright 2019-2020 Franz Brauße <brausse@informatik.uni-trier.de>
+ *
+ * This file is part of kjson.
+ * See the LICENSE file for terms of distribution.
+ */
+
+/* Requires C11 (for anonymous struct / union members)
+ * and      _POSIX_C_SOURCE >= 200809L
+ *
+ * Reads a JSON Schema and writes C source code to stdout containing struct
+ * definitions and decoders for documents following this schema. The decoders
+ * directly use kjson's low-level interface, no callbacks and no DOM.
+ *
+ * Supported is the following subset of JSON Schema: the "type"s "object"
+ * (with "properties" and "required"), "array" (with "items"), "string",
+ * "integer", "number" and "boolean", each optionally combined with "null" as
+ * in "type": ["integer", "null"]. Object members not described in the schema
+ * are skipped.
+ *
+ * For each object type with name N, the following is generated:
+ *
+ *   struct N { uint64_t has, present; ... };
+ *   bool N_decode(struct kjson_parser *p, struct N *r);
+ *   void N_fini(struct N *r);
+ *
+ * where bit i in 'present' is set if the i-th property was present and in
+ * 'has' if moreover its value was not null. N_decode() initializes *r and
+ * fails if a required property is missing (null counts as present);
+ * regardless of its result, N_fini() has to be called afterwards. Strings are
+ * represented as struct kjson_string pointing into the parsed source,
+ * integers as int64_t, numbers as double and arrays as
+ *
+ *   struct N_P { T *data; size_t n; };
+ *
+ * The name of the top-level type is given by option -n, it defaults to the
+ * schema's "title". Names of nested types are formed by appending '_' and the
+ * property's name. Where different keys map to the same C identifier, e.g.
+ * "a-b" and "a_b", a suffix "_2", "_3", etc. is appended.
+ */
+
+#include <stdio.h>	/* FILE, fopen(3), fread(3), printf(3) */
+#include <stdlib.h>	/* exit(3), malloc(3), free(3) */
+#include <string.h>	/* strlen(3), memcmp(3) */
+#include <ctype.h>	/* isalnum(3), isprint(3) */
+#include <unistd.h>	/* getopt(3) */
+
+#include "kjson.h"
+
+#define DIE(code,...) do { fprintf(stderr, __VA_ARGS__); exit(code); } while (0)
+
+#define MAX_PROPS	64
+
+enum kind { T_STRING, T_INTEGER, T_NUMBER, T_BOOLEAN, T_OBJECT, T_ARRAY, T_N };
+
+static const char *const c_types[] = {
+	[T_STRING ] = "struct kjson_string",
+	[T_INTEGER] = "int64_t",
+	[T_NUMBER ] = "double",
+	[T_BOOLEAN] = "bool",
+};
+
+struct prop;
+
+struct type {
+	enum kind kind;
+	bool nullable;
+	char *name;       /* for T_OBJECT and T_ARRAY */
+	struct prop *props;
+	size_t n_props;
+	struct type *items;
+	struct type *next; /* list of types in dependency order */
+};
+
+struct prop {
+	size_t idx;
+	const struct kjson_string *key;
+	char *ident;
+	bool required;
+	struct type *t;
+};
+
+static struct type *types, **types_tail = &types;
+static char **type_names;
+static size_t n_type_names;
+
+static const struct kjson_value * member(const struct kjson_value *o,
+                                         const char *key)
+{
+	const struct kjson_object_entry *e;
+	e = kjson_object_find(&o->o, key, strlen(key));
+	return e ? &e->value : NULL;
+}
+
+/* Returns a valid C identifier derived from s[0..len-1]. */
+static char * ident(const char *prefix, const char *s, size_t len)
+{
+	size_t plen = prefix ? strlen(prefix) + 1 : 0;
+	char *r = malloc(plen + len + 2), *t = r;
+	if (prefix)
+		t += sprintf(t, "%s_", prefix);
+	else if (!len || isdigit((unsigned char)*s))
+		*t++ = '_';
+	for (size_t i=0; i<len; i++)
+		*t++ = isalnum((unsigned char)s[i]) ? s[i] : '_';
+	*t = '\0';
+	return r;
+}
+
+static bool taken(const char *id, char *const *used, size_t n)
+{
+	for (size_t i=0; i<n; i++)
+		if (!strcmp(id, used[i]))
+			return true;
+	return false;
+}
+
+/* Returns id if it is not in used[0..n-1], otherwise frees it and returns id
+ * with the smallest suffix "_2", "_3", ... that is not. */
+static char * unique(char *id, char *const *used, size_t n)
+{
+	if (!taken(id, used, n))
+		return id;
+	char *r = malloc(strlen(id) + 24);
+	for (unsigned long k=2; sprintf(r, "%s_%lu", id, k), taken(r, used, n);
+	     k++);
+	free(id);
+	return r;
+}
+
+static bool kind_of(const struct kjson_string *s, struct type *t)
+{
+	static const char *const names[] = {
+		[T_STRING ] = "string",
+		[T_INTEGER] = "integer",
+		[T_NUMBER ] = "number",
+		[T_BOOLEAN] = "boolean",
+		[T_OBJECT ] = "object",
+		[T_ARRAY  ] = "array",
+	};
+	if (s->len == 4 && !memcmp(s->begin, "null", 4)) {
+		t->nullable = true;
+		return true;
+	}
+	for (size_t i=0; i<sizeof(names)/sizeof(*names); i++)
+		if (s->len == strlen(names[i]) &&
+		    !memcmp(s->begin, names[i], s->len)) {
+			t->kind = i;
+			return true;
+		}
+	return false;
+}
+
+static struct type * type(const struct kjson_value *v, char *name)
+{
+	if (v->type != KJSON_VALUE_OBJECT)
+		DIE(1,"error: schema of '%s' is not an object\n", name);
+	const struct kjson_value *ty = member(v, "type");
+	struct type *t = calloc(1, sizeof(*t));
+	t->kind = T_N;
+	t->name = name;
+	if (ty && ty->type == KJSON_VALUE_STRING) {
+		if (!kind_of(&ty->s, t))
+			DIE(1,"error: unsupported type '%s' of '%s'\n",
+			    ty->s.begin, name);
+	} else if (ty && ty->type == KJSON_VALUE_ARRAY) {
+		for (size_t i=0; i<ty->a.n; i++)
+			if (ty->a.data[i].type != KJSON_VALUE_STRING ||
+			    !kind_of(&ty->a.data[i].s, t))
+				DIE(1,"error: unsupported type of '%s'\n", name);
+	}
+	if (t->kind == T_N)
+		DIE(1,"error: '%s' has no supported 'type'\n", name);
+	if (t->kind == T_OBJECT || t->kind == T_ARRAY) {
+		name = t->name = unique(name, type_names, n_type_names);
+		type_names = realloc(type_names,
+		                     (n_type_names + 1) * sizeof(*type_names));
+		type_names[n_type_names++] = name;
+	}
+
+	if (t->kind == T_OBJECT) {
+		const struct kjson_value *pr = member(v, "properties");
+		const struct kjson_value *rq = member(v, "required");
+		if (pr && pr->type == KJSON_VALUE_OBJECT) {
+			if (pr->o.n > MAX_PROPS)
+				DIE(1,"error: '%s' has more than %d properties\n",
+				    name, MAX_PROPS);
+			t->n_props = pr->o.n;
+			t->props = calloc(t->n_props, sizeof(*t->props));
+		}
+		/* member names in use: the masks and the previous properties */
+		char *used[MAX_PROPS + 2] = { "has", "present" };
+		for (size_t i=0; i<t->n_props; i++) {
+			struct prop *q = &t->props[i];
+			q->idx = i;
+			q->key = &pr->o.data[i].key;
+			q->ident = unique(ident(NULL, q->key->begin, q->key->len),
+			                  used, i + 2);
+			used[i + 2] = q->ident;
+			q->t = type(&pr->o.data[i].value,
+			            ident(name, q->key->begin, q->key->len));
+			for (size_t j=0; rq && rq->type == KJSON_VALUE_ARRAY &&
+			                 j<rq->a.n; j++)
+				if (rq->a.data[j].type == KJSON_VALUE_STRING &&
+				    rq->a.data[j].s.len == q->key->len &&
+				    !memcmp(rq->a.data[j].s.begin, q->key->begin,
+				            q->key->len))
+					q->required = true;
+		}
+	} else if (t->kind == T_ARRAY) {
+		const struct kjson_value *it = member(v, "items");
+		if (!it)
+			DIE(1,"error: array '%s' has no 'items'\n", name);
+		t->items = type(it, ident(name, "item", 4));
+	}
+	if (t->kind == T_OBJECT || t->kind == T_ARRAY) {
+		*types_tail = t;
+		types_tail = &t->next;
+	}
+	return t;
+}
+
+static const char * c_type(const struct type *t)
+{
+	static char buf[256];
+	if (t->kind != T_OBJECT && t->kind != T_ARRAY)
+		return c_types[t->kind];
+	snprintf(buf, sizeof(buf), "struct %s", t->name);
+	return buf;
+}
+
+static void gen_struct(const struct type *t)
+{
+	printf("struct %s {\n", t->name);
+	if (t->kind == T_ARRAY) {
+		printf("\t%s *data;\n", c_type(t->items));
+		printf("\tsize_t n;\n");
+	} else {
+		printf("\tuint64_t has, present;\n");
+		for (size_t i=0; i<t->n_props; i++)
+			printf("\t%s %s;\n", c_type(t->props[i].t),
+			       t->props[i].ident);
+	}
+	printf("};\n\n");
+}
+
+static void gen_protos(const struct type *t, const char *storage)
+{
+	printf("%sbool %s_decode(struct kjson_parser *p, struct %s *r);\n",
+	       storage, t->name, t->name);
+	printf("%svoid %s_fini(struct %s *r);\n", storage, t->name, t->name);
+}
+
+/* Prints a C expression decoding a value of type *t into the lvalue 'dest'. */
+static void gen_decode_expr(const struct type *t, const char *dest)
+{
+	switch (t->kind) {
+	case T_STRING:
+		printf("kjson_read_string_utf8(p, &%s.begin, &%s.len)",
+		       dest, dest);
+		break;
+	case T_INTEGER: printf("kjson_gen_integer(p, &%s)", dest); break;
+	case T_NUMBER : printf("kjson_gen_number(p, &%s)", dest); break;
+	case T_BOOLEAN: printf("kjson_read_bool(p, &%s)", dest); break;
+	case T_OBJECT:
+	case T_ARRAY:
+		printf("%s_decode(p, &%s)", t->name, dest);
+		break;
+	case T_N:
+		break;
+	}
+}
+
+static int cmp_key_len(const void *a, const void *b)
+{
+	const struct prop *p = a, *q = b;
+	return p->key->len < q->key->len ? -1 : p->key->len > q->key->len;
+}
+
+static void gen_object(const struct type *t)
+{
+	uint64_t required = 0;
+	for (size_t i=0; i<t->n_props; i++)
+		if (t->props[i].required)
+			required |= (uint64_t)1 << i;
+
+	printf("bool %s_decode(struct kjson_parser *p, struct %s *r)\n{\n",
+	       t->name, t->name);
+	printf("\tmemset(r, 0, sizeof(*r));\n"
+	       "\tif (*p->s != '{')\n"
+	       "\t\treturn false;\n"
+	       "\tp->s++;\n"
+	       "\tkjson_gen_space(p);\n"
+	       "\tif (*p->s != '}')\n"
+	       "\t\tdo {\n"
+	       "\t\t\tchar *k;\n"
+	       "\t\t\tsize_t n;\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t\tif (!kjson_read_string_utf8(p, &k, &n))\n"
+	       "\t\t\t\treturn false;\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t\tif (*p->s != ':')\n"
+	       "\t\t\t\treturn false;\n"
+	       "\t\t\tp->s++;\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t\tint f = -1;\n"
+	       "\t\t\tbool null = false;\n");
+	if (t->n_props) {
+		/* dispatch on the length of the key, then memcmp(3) */
+		struct prop *sorted = malloc(t->n_props * sizeof(*sorted));
+		memcpy(sorted, t->props, t->n_props * sizeof(*sorted));
+		qsort(sorted, t->n_props, sizeof(*sorted), cmp_key_len);
+		printf("\t\t\tswitch (n) {\n");
+		for (size_t i=0; i<t->n_props; i++) {
+			const struct prop *q = &sorted[i];
+			if (!i || sorted[i-1].key->len != q->key->len) {
+				if (i)
+					printf("\t\t\t\tbreak;\n");
+				printf("\t\t\tcase %zu:\n", q->key->len);
+			}
+			printf("\t\t\t\tif (!memcmp(k, \"");
+			for (size_t j=0; j<q->key->len; j++) {
+				unsigned char ch = q->key->begin[j];
+				if (ch == '"' || ch == '\\' || !isprint(ch))
+					printf("\\%03o", ch);
+				else
+					putchar(ch);
+			}
+			printf("\", %zu)) { f = %zu; break; }\n", q->key->len,
+			       q->idx);
+		}
+		printf("\t\t\t\tbreak;\n\t\t\t}\n");
+		free(sorted);
+	}
+	printf("\t\t\tbool ok;\n"
+	       "\t\t\tswitch (f) {\n");
+	for (size_t i=0; i<t->n_props; i++) {
+		const struct prop *q = &t->props[i];
+		char dest[256];
+		snprintf(dest, sizeof(dest), "r->%s", q->ident);
+		printf("\t\t\tcase %zu:\n", i);
+		/* duplicate key: release the previous value */
+		if (q->t->kind == T_OBJECT || q->t->kind == T_ARRAY)
+			printf("\t\t\t\tif (r->has & UINT64_C(1) << %zu) {\n"
+			       "\t\t\t\t\t%s_fini(&%s);\n"
+			       "\t\t\t\t\tmemset(&%s, 0, sizeof(%s));\n"
+			       "\t\t\t\t}\n", i, q->t->name, dest, dest, dest);
+		printf("\t\t\t\tr->has &= ~(UINT64_C(1) << %zu);\n", i);
+		printf("\t\t\t\tok = ");
+		if (q->t->nullable)
+			printf("(null = kjson_read_null(p)) || ");
+		gen_decode_expr(q->t, dest);
+		printf(";\n\t\t\t\tbreak;\n");
+	}
+	printf("\t\t\tdefault:\n"
+	       "\t\t\t\tok = kjson_skip(p);\n"
+	       "\t\t\t}\n"
+	       "\t\t\tif (!ok)\n"
+	       "\t\t\t\treturn false;\n"
+	       "\t\t\tif (f >= 0) {\n"
+	       "\t\t\t\tr->present |= UINT64_C(1) << f;\n"
+	       "\t\t\t\tif (!null)\n"
+	       "\t\t\t\t\tr->has |= UINT64_C(1) << f;\n"
+	       "\t\t\t}\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t} while (*p->s == ',' && (p->s++, true));\n"
+	       "\tif (*p->s != '}')\n"
+	       "\t\treturn false;\n"
+	       "\tp->s++;\n"
+	       "\treturn (r->present & UINT64_C(%#llx)) == UINT64_C(%#llx);\n"
+	       "}\n\n", (unsigned long long)required,
+	       (unsigned long long)required);
+
+	printf("void %s_fini(struct %s *r)\n{\n\t(void)r;\n", t->name, t->name);
+	for (size_t i=0; i<t->n_props; i++) {
+		const struct prop *q = &t->props[i];
+		if (q->t->kind == T_OBJECT || q->t->kind == T_ARRAY)
+			printf("\t%s_fini(&r->%s);\n", q->t->name, q->ident);
+	}
+	printf("}\n\n");
+}
+
+static void gen_array(const struct type *t)
+{
+	const struct type *it = t->items;
+	printf("bool %s_decode(struct kjson_parser *p, struct %s *r)\n{\n",
+	       t->name, t->name);
+	printf("\tsize_t cap = 0;\n"
+	       "\tr->data = NULL;\n"
+	       "\tr->n = 0;\n"
+	       "\tif (*p->s != '[')\n"
+	       "\t\treturn false;\n"
+	       "\tp->s++;\n"
+	       "\tkjson_gen_space(p);\n"
+	       "\tif (*p->s != ']')\n"
+	       "\t\tdo {\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t\tif (r->n == cap) {\n"
+	       "\t\t\t\tcap = cap ? 2 * cap : 4;\n"
+	       "\t\t\t\tvoid *d = realloc(r->data, cap * sizeof(*r->data));\n"
+	       "\t\t\t\tif (!d)\n"
+	       "\t\t\t\t\treturn false;\n"
+	       "\t\t\t\tr->data = d;\n"
+	       "\t\t\t}\n"
+	       "\t\t\tmemset(&r->data[r->n++], 0, sizeof(*r->data));\n"
+	       "\t\t\tif (!");
+	if (it->nullable)
+		printf("kjson_read_null(p) && !");
+	gen_decode_expr(it, "r->data[r->n-1]");
+	printf(")\n"
+	       "\t\t\t\treturn false;\n"
+	       "\t\t\tkjson_gen_space(p);\n"
+	       "\t\t} while (*p->s == ',' && (p->s++, true));\n"
+	       "\tif (*p->s != ']')\n"
+	       "\t\treturn false;\n"
+	       "\tp->s++;\n"
+	       "\treturn true;\n"
+	       "}\n\n");
+
+	printf("void %s_fini(struct %s *r)\n{\n", t->name, t->name);
+	if (it->kind == T_OBJECT || it->kind == T_ARRAY)
+		printf("\tfor (size_t i=0; i<r->n; i++)\n"
+		       "\t\t%s_fini(&r->data[i]);\n", it->name);
+	printf("\tfree(r->data);\n}\n\n");
+}
+
+static const char helpers[] = "\
+static inline void kjson_gen_space(struct kjson_parser *p)\n\
+{\n\
+	if ((unsigned char)*p->s <= ' ')\n\
+		kjson_skip_space(p);\n\
+}\n\
+\n\
+static bool kjson_gen_integer(struct kjson_parser *p, int64_t *v)\n\
+{\n\
+	union kjson_leaf_raw l;\n\
+	if (kjson_read_number(p, &l) < 0 || l.n.fractional != l.n.end)\n\
+		return false;\n\
+	const char *s = l.n.integer;\n\
+	bool neg = *s == '-';\n\
+	uint64_t x = 0, max = neg ? (uint64_t)INT64_MAX + 1 : INT64_MAX;\n\
+	for (s += neg; s < l.n.fractional; s++) {\n\
+		unsigned d = *s - '0';\n\
+		if (x > (max - d) / 10)\n\
+			return false;\n\
+		x = 10 * x + d;\n\
+	}\n\
+	*v = neg ? (x ? -(int64_t)(x - 1) - 1 : 0) : (int64_t)x;\n\
+	return true;\n\
+}\n\
+\n\
+static bool kjson_gen_number(struct kjson_parser *p, double *v)\n\
+{\n\
+	union kjson_leaf_raw l;\n\
+	if (kjson_read_number(p, &l) < 0)\n\
+		return false;\n\
+	*v = strtod(l.n.integer, NULL);\n\
+	return true;\n\
+}\n\
+\n";
+
+int main(int argc, char **argv)
+{
+	const char *name = NULL;
+	for (int opt; (opt = getopt(argc, argv, ":hn:")) != -1;)
+		switch (opt) {
+		case 'h': DIE(1,"usage: %s [-n NAME] [SCHEMA]\n", argv[0]);
+		case 'n': name = optarg; break;
+		case ':': DIE(1,"error: option '-%c' requires a parameter\n",
+			        optopt);
+		case '?': DIE(1,"error: unknown option '-%c'\n", optopt);
+		}
+	const char *path = optind < argc ? argv[optind] : NULL;
+	FILE *f = path ? fopen(path, "r") : stdin;
+	if (!f)
+		DIE(1,"error: cannot open '%s'\n", path);
+	char *data = NULL;
+	size_t data_sz = 0;
+	for (size_t rd; data = realloc(data, data_sz + 4097),
+	                (rd = fread(data + data_sz, 1, 4096, f)) > 0;)
+		data_sz += rd;
+	data[data_sz] = '\0';
+	if (path)
+		fclose(f);
+
+	struct kjson_parser p = { .s = data };
+	struct kjson_value schema;
+	if (!kjson_parse(&p, &schema))
+		DIE(1,"error: cannot parse schema\n");
+	if (!name) {
+		const struct kjson_value *title = schema.type == KJSON_VALUE_OBJECT
+		                                ? member(&schema, "title") : NULL;
+		if (!title || title->type != KJSON_VALUE_STRING)
+			DIE(1,"error: schema has no 'title', use option -n\n");
+		name = title->s.begin;
+	}
+	struct type *root = type(&schema, ident(NULL, name, strlen(name)));
+	if (root->kind != T_OBJECT && root->kind != T_ARRAY)
+		DIE(1,"error: top-level type must be an object or an array\n");
+
+	printf("/* generated by kjson-gen from %s, do not edit */\n\n"
+	       "#include <stdint.h>\n"
+	       "#include <stdlib.h>\n"
+	       "#include <string.h>\n\n"
+	       "#include <kjson.h>\n\n", path ? path : "<stdin>");
+	for (const struct type *t = types; t; t = t->next)
+		gen_struct(t);
+	for (const struct type *t = types; t; t = t->next)
+		gen_protos(t, t == root ? "" : "static ");
+	printf("\n%s", helpers);
+	for (const struct type *t = types; t; t = t->next)
+		if (t->kind == T_OBJECT)
+			gen_object(t);
+		else
+			gen_array(t);
+
+	kjson_value_fini(&schema);
+	free(data);
+	return 0;
+}
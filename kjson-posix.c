@@ -0,0 +1,1362 @@
+/*
+ * kjson-posix.c
+ *
+ * Copyright 2019-2020 Franz Brauße <brausse@informatik.uni-trier.de>
+ *
+ * This file is part of kjson.
+ * See the LICENSE file for terms of distribution.
+ */
+
+/* Requires C11 (for anonymous struct / union members)
+ * and      _POSIX_C_SOURCE >= 200809L (for POSIX threads) */
+
+#include <stdlib.h>	/* malloc(3), free(3) */
+#include <string.h>	/* memset(3) */
+#include <stdatomic.h>	/* atomic_size_t */
+#include <pthread.h>	/* pthread_create(3p), pthread_mutex_lock(3p) */
+#include <sched.h>	/* sched_yield(3p) */
+#include <unistd.h>	/* sysconf(3p) */
+#include <limits.h>	/* IOV_MAX */
+#include <errno.h>	/* errno(3) */
+#include <fcntl.h>	/* posix_fadvise(3p) */
+#include <stdio.h>	/* sprintf(3) */
+#include <time.h>	/* clock_gettime(3p) */
+#include <dirent.h>	/* opendir(3p), readdir(3p) */
+#include <sys/uio.h>	/* writev(3p) */
+#include <sys/stat.h>	/* stat(3p) */
+#include <sys/mman.h>	/* mmap(3p) */
+
+#include "kjson.h"
+
+/* Static tracepoints of the drivers, see kjson.c and kjson.bt. */
+#ifdef KJSON_USDT
+# include <sys/sdt.h>
+# define PROBE(...)	STAP_PROBEV(kjson, __VA_ARGS__)
+#else
+# define PROBE(...)	((void)0)
+#endif
+
+static unsigned n_threads(unsigned n)
+{
+	if (!n) {
+		long k = sysconf(_SC_NPROCESSORS_ONLN);
+		n = k > 0 ? k : 1;
+	}
+	return n;
+}
+
+/* --------------------------------------------------------------------------
+ * parallel visitor
+ * -------------------------------------------------------------------------- */
+
+/* Ranges of more than VISIT_GRAIN children are split for other threads to
+ * steal, composites with at most VISIT_INLINE children are visited right away
+ * unless they are nested deeper than VISIT_INLINE_DEPTH. */
+#define VISIT_GRAIN		1024
+#define VISIT_INLINE		32
+#define VISIT_INLINE_DEPTH	16
+/* Idle threads yield this many times before blocking until work arrives. */
+#define VISIT_SPIN		16
+
+/* Visit the children v[lo..hi-1] of the composite *v. */
+struct visit_task {
+	const struct kjson_value *v;
+	size_t lo, hi;
+};
+
+/* The owning thread pushes and pops at the tail, others steal from the head,
+ * i.e., the oldest and therefore usually biggest tasks. */
+struct visit_deque {
+	pthread_mutex_t mtx;
+	struct visit_task *t;
+	size_t head, tail, cap;
+};
+
+struct visit_pool;
+
+struct visit_worker {
+	struct visit_deque dq;
+	struct visit_pool *pool;
+	void *acc;
+	unsigned seed;
+	pthread_t tid;
+};
+
+struct visit_pool {
+	const struct kjson_visitor *vis;
+	struct visit_worker *w;
+	unsigned n;
+	/* number of tasks pushed and not yet finished */
+	atomic_size_t pending;
+	/* Idle threads wait on cond for gen, incremented on every push, to
+	 * change or for pending to drop to 0. */
+	atomic_size_t gen;
+	atomic_uint sleeping;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+};
+
+/* Wakes one or all threads blocked in visit_wait(), if any. */
+static void visit_wake(struct visit_pool *pool, bool all)
+{
+	if (!atomic_load(&pool->sleeping))
+		return;
+	pthread_mutex_lock(&pool->mtx);
+	if (all)
+		pthread_cond_broadcast(&pool->cond);
+	else
+		pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+/* Blocks until a task has been pushed since pool->gen was 'gen' or all tasks
+ * are finished. */
+static void visit_wait(struct visit_pool *pool, size_t gen)
+{
+	pthread_mutex_lock(&pool->mtx);
+	atomic_fetch_add(&pool->sleeping, 1);
+	while (atomic_load(&pool->gen) == gen && atomic_load(&pool->pending))
+		pthread_cond_wait(&pool->cond, &pool->mtx);
+	atomic_fetch_sub(&pool->sleeping, 1);
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+static bool visit_push(struct visit_worker *w, struct visit_task t)
+{
+	struct visit_deque *dq = &w->dq;
+	atomic_fetch_add(&w->pool->pending, 1);
+	pthread_mutex_lock(&dq->mtx);
+	if (dq->tail == dq->cap) {
+		/* compact or grow */
+		if (dq->head) {
+			memmove(dq->t, dq->t + dq->head,
+			        (dq->tail - dq->head) * sizeof(*dq->t));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		} else {
+			size_t cap = dq->cap ? 2 * dq->cap : 64;
+			void *d = realloc(dq->t, cap * sizeof(*dq->t));
+			if (!d) {
+				pthread_mutex_unlock(&dq->mtx);
+				atomic_fetch_sub(&w->pool->pending, 1);
+				return false;
+			}
+			dq->t = d;
+			dq->cap = cap;
+		}
+	}
+	dq->t[dq->tail++] = t;
+	pthread_mutex_unlock(&dq->mtx);
+	atomic_fetch_add(&w->pool->gen, 1);
+	visit_wake(w->pool, false);
+	return true;
+}
+
+static bool visit_take(struct visit_deque *dq, struct visit_task *t, bool steal)
+{
+	bool r = false;
+	pthread_mutex_lock(&dq->mtx);
+	if (dq->head < dq->tail) {
+		*t = steal ? dq->t[dq->head++] : dq->t[--dq->tail];
+		r = true;
+	}
+	pthread_mutex_unlock(&dq->mtx);
+	return r;
+}
+
+static const struct kjson_value * visit_child(const struct kjson_value *v,
+                                              size_t i)
+{
+	return v->type == KJSON_VALUE_ARRAY ? &v->a.data[i]
+	                                    : &v->o.data[i].value;
+}
+
+static size_t visit_n_children(const struct kjson_value *v)
+{
+	switch (v->type) {
+	case KJSON_VALUE_ARRAY: return v->a.n;
+	case KJSON_VALUE_OBJECT: return v->o.n;
+	default: return 0;
+	}
+}
+
+static void visit_rec(struct visit_worker *w, const struct kjson_value *v,
+                      unsigned depth)
+{
+	const struct kjson_visitor *vis = w->pool->vis;
+	vis->visit(vis, v, w->acc);
+	size_t n = visit_n_children(v);
+	if (!n)
+		return;
+	if ((n > VISIT_INLINE || depth >= VISIT_INLINE_DEPTH) &&
+	    visit_push(w, (struct visit_task){ v, 0, n }))
+		return;
+	for (size_t i=0; i<n; i++)
+		visit_rec(w, visit_child(v, i), depth+1);
+}
+
+static void visit_run(struct visit_worker *w, struct visit_task t)
+{
+	/* leave the upper halves of big ranges to be stolen */
+	while (t.hi - t.lo > VISIT_GRAIN) {
+		size_t mid = t.lo + (t.hi - t.lo) / 2;
+		if (!visit_push(w, (struct visit_task){ t.v, mid, t.hi }))
+			break;
+		t.hi = mid;
+	}
+	for (size_t i=t.lo; i<t.hi; i++)
+		visit_rec(w, visit_child(t.v, i), 0);
+}
+
+static void * visit_worker(void *arg)
+{
+	struct visit_worker *w = arg;
+	struct visit_pool *pool = w->pool;
+	for (unsigned idle = 0; atomic_load(&pool->pending);) {
+		size_t gen = atomic_load(&pool->gen);
+		struct visit_task t;
+		bool have = visit_take(&w->dq, &t, false);
+		for (unsigned i=0; !have && i<pool->n; i++) {
+			/* xorshift */
+			w->seed ^= w->seed << 13;
+			w->seed ^= w->seed >> 17;
+			w->seed ^= w->seed << 5;
+			struct visit_worker *victim = &pool->w[w->seed % pool->n];
+			if (victim != w)
+				have = visit_take(&victim->dq, &t, true);
+		}
+		if (!have) {
+			if (++idle < VISIT_SPIN)
+				sched_yield();
+			else
+				visit_wait(pool, gen);
+			continue;
+		}
+		idle = 0;
+		visit_run(w, t);
+		if (atomic_fetch_sub(&pool->pending, 1) == 1)
+			visit_wake(pool, true);
+	}
+	return NULL;
+}
+
+bool kjson_visit_parallel(const struct kjson_value *v,
+                          const struct kjson_visitor *vis, unsigned nthreads,
+                          void *acc)
+{
+	struct visit_pool pool = {
+		.vis = vis,
+		.n   = n_threads(nthreads),
+	};
+	atomic_init(&pool.pending, 0);
+	atomic_init(&pool.gen, 0);
+	atomic_init(&pool.sleeping, 0);
+	pool.w = calloc(pool.n, sizeof(*pool.w));
+	if (!pool.w)
+		return false;
+	pthread_mutex_init(&pool.mtx, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	bool r = true;
+	unsigned n;
+	for (n=0; n<pool.n; n++) {
+		struct visit_worker *w = &pool.w[n];
+		w->pool = &pool;
+		w->seed = 2463534242u + n;
+		if (vis->acc_size && !(w->acc = calloc(1, vis->acc_size))) {
+			r = false;
+			break;
+		}
+		pthread_mutex_init(&w->dq.mtx, NULL);
+	}
+	if (r) {
+		/* the calling thread is worker 0 */
+		struct visit_worker *w0 = &pool.w[0];
+		vis->visit(vis, v, w0->acc);
+		size_t k = visit_n_children(v);
+		if (k && !visit_push(w0, (struct visit_task){ v, 0, k }))
+			r = false;
+	}
+	if (r) {
+		/* if threads cannot be created, the others do their work */
+		unsigned started = 1;
+		for (; started<pool.n; started++)
+			if (pthread_create(&pool.w[started].tid, NULL,
+			                   visit_worker, &pool.w[started]))
+				break;
+		visit_worker(&pool.w[0]);
+		for (unsigned i=1; i<started; i++)
+			pthread_join(pool.w[i].tid, NULL);
+		for (unsigned i=0; vis->acc_size && i<pool.n; i++)
+			vis->reduce(vis, acc, pool.w[i].acc);
+	}
+	for (unsigned i=0; i<n; i++) {
+		pthread_mutex_destroy(&pool.w[i].dq.mtx);
+		free(pool.w[i].dq.t);
+		free(pool.w[i].acc);
+	}
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mtx);
+	free(pool.w);
+	return r;
+}
+
+/* --------------------------------------------------------------------------
+ * parallel serializer
+ * -------------------------------------------------------------------------- */
+
+/* Number of values per chunk and chunks buffered per thread. */
+#define WRITE_GRAIN		4096
+#define WRITE_WINDOW		16
+
+#ifdef IOV_MAX
+# define WRITE_IOV		(IOV_MAX < 1024 ? IOV_MAX : 1024)
+#else
+# define WRITE_IOV		16 /* _XOPEN_IOV_MAX */
+#endif
+
+struct write_buf {
+	char *data;
+	size_t len;
+	bool done;
+};
+
+struct write_pool {
+	const struct kjson_print_chunk *c;
+	struct write_buf *b;
+	size_t n;
+	size_t next;    /* next chunk to print */
+	size_t written; /* chunks before this one have been written */
+	size_t window;
+	int err;        /* errno of the first error, if any */
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+};
+
+/* Prints the next chunk into memory, called and returning with pool->mtx
+ * locked. */
+static void write_chunk(struct write_pool *pool)
+{
+	size_t i = pool->next++;
+	pthread_mutex_unlock(&pool->mtx);
+	struct write_buf b = { NULL, 0, true };
+	FILE *f = open_memstream(&b.data, &b.len);
+	int err = 0;
+	if (f) {
+		kjson_value_print_chunk(f, &pool->c[i]);
+		if (fclose(f))
+			err = errno;
+	} else
+		err = errno;
+	pthread_mutex_lock(&pool->mtx);
+	if (err && !pool->err)
+		pool->err = err;
+	pool->b[i] = b;
+	pthread_cond_broadcast(&pool->cond);
+}
+
+static void * write_worker(void *arg)
+{
+	struct write_pool *pool = arg;
+	pthread_mutex_lock(&pool->mtx);
+	while (!pool->err && pool->next < pool->n) {
+		if (pool->next >= pool->written + pool->window) {
+			pthread_cond_wait(&pool->cond, &pool->mtx);
+			continue;
+		}
+		write_chunk(pool);
+	}
+	pthread_mutex_unlock(&pool->mtx);
+	return NULL;
+}
+
+static bool write_all(int fd, struct iovec *iov, int n)
+{
+	while (n) {
+		ssize_t r = writev(fd, iov, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		for (; n && (size_t)r >= iov->iov_len; iov++, n--)
+			r -= iov->iov_len;
+		if (n) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	return true;
+}
+
+bool kjson_value_write_parallel(int fd, const struct kjson_value *v,
+                                unsigned nthreads)
+{
+	struct kjson_print_chunk *c;
+	struct write_pool pool = { .window = WRITE_WINDOW };
+	unsigned n = n_threads(nthreads);
+	pool.n = kjson_value_print_plan(v, WRITE_GRAIN, &c);
+	if (!pool.n)
+		return false;
+	pool.c = c;
+	pool.window *= n;
+	pool.b = calloc(pool.n, sizeof(*pool.b));
+	if (!pool.b) {
+		free(c);
+		errno = ENOMEM;
+		return false;
+	}
+	pthread_mutex_init(&pool.mtx, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pthread_t *tids = n > 1 ? calloc(n - 1, sizeof(*tids)) : NULL;
+	/* the calling thread is one of the printers; if threads cannot be
+	 * created, it prints the chunks the others would have */
+	unsigned started = 0;
+	for (; tids && started < n-1; started++)
+		if (pthread_create(&tids[started], NULL, write_worker, &pool))
+			break;
+
+	/* the calling thread writes the chunks in order and prints the next
+	 * one while it waits */
+	struct iovec iov[WRITE_IOV];
+	int err;
+	pthread_mutex_lock(&pool.mtx);
+	while (!pool.err && pool.written < pool.n) {
+		if (!pool.b[pool.written].done) {
+			if (pool.next < pool.n &&
+			    pool.next < pool.written + pool.window)
+				write_chunk(&pool);
+			else
+				pthread_cond_wait(&pool.cond, &pool.mtx);
+			continue;
+		}
+		size_t lo = pool.written, hi = lo;
+		for (; hi < pool.n && hi - lo < WRITE_IOV && pool.b[hi].done;
+		     hi++)
+			iov[hi - lo] = (struct iovec){ pool.b[hi].data,
+			                               pool.b[hi].len };
+		pthread_mutex_unlock(&pool.mtx);
+		err = write_all(fd, iov, hi - lo) ? 0 : errno;
+		for (size_t i=lo; i<hi; i++) {
+			free(pool.b[i].data);
+			pool.b[i].data = NULL;
+		}
+		pthread_mutex_lock(&pool.mtx);
+		if (err && !pool.err)
+			pool.err = err;
+		pool.written = hi;
+		pthread_cond_broadcast(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.mtx);
+
+	for (unsigned i=0; i<started; i++)
+		pthread_join(tids[i], NULL);
+	for (size_t i=pool.written; i<pool.n; i++)
+		free(pool.b[i].data);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mtx);
+	free(tids);
+	free(pool.b);
+	free(c);
+	if (pool.err)
+		errno = pool.err;
+	return !pool.err;
+}
+
+/* --------------------------------------------------------------------------
+ * vectored output
+ * -------------------------------------------------------------------------- */
+
+/* Spans up to IOV_INLINE bytes are copied; generated bytes are stored in blocks
+ * of at least IOV_BLOCK bytes, which never move. */
+#define IOV_INLINE		32
+#define IOV_BLOCK		4096
+
+struct kjson_iov_block {
+	struct kjson_iov_block *next;
+	size_t len, cap;
+	char data[];
+};
+
+static bool iov_push(struct kjson_iov *o, const char *p, size_t n)
+{
+	struct iovec *last = o->n ? &o->iov[o->n-1] : NULL;
+	if (last && (char *)last->iov_base + last->iov_len == p) {
+		last->iov_len += n;
+		return true;
+	}
+	if (o->n == o->cap) {
+		size_t cap = o->cap ? 2 * o->cap : 64;
+		void *iov = realloc(o->iov, cap * sizeof(*o->iov));
+		if (!iov)
+			return false;
+		o->iov = iov;
+		o->cap = cap;
+	}
+	o->iov[o->n++] = (struct iovec){ (void *)p, n };
+	return true;
+}
+
+/* Returns space for at least n bytes to be used by iov_commit(). */
+static char * iov_reserve(struct kjson_iov *o, size_t n)
+{
+	struct kjson_iov_block *b = o->blocks;
+	if (!b || b->cap - b->len < n) {
+		size_t cap = n > IOV_BLOCK ? n : IOV_BLOCK;
+		if (!(b = malloc(sizeof(*b) + cap)))
+			return NULL;
+		b->next = o->blocks;
+		b->len = 0;
+		b->cap = cap;
+		o->blocks = b;
+	}
+	return b->data + b->len;
+}
+
+static bool iov_commit(struct kjson_iov *o, size_t n)
+{
+	struct kjson_iov_block *b = o->blocks;
+	b->len += n;
+	return iov_push(o, b->data + b->len - n, n);
+}
+
+static bool iov_copy(struct kjson_iov *o, const char *p, size_t n)
+{
+	char *w = iov_reserve(o, n);
+	if (!w)
+		return false;
+	memcpy(w, p, n);
+	return iov_commit(o, n);
+}
+
+/* Appends the string *s, which is copied verbatim if raw is set. */
+static bool iov_string(struct kjson_iov *o, const struct kjson_string *s,
+                       bool raw)
+{
+	bool esc = false;
+	for (size_t i=0; !raw && !esc && i<s->len; i++)
+		esc = s->begin[i] == '"' || s->begin[i] == '\\' ||
+		      (unsigned char)s->begin[i] <= 0x1f;
+	if (!esc && s->len > IOV_INLINE)
+		return iov_copy(o, "\"", 1) && iov_push(o, s->begin, s->len) &&
+		       iov_copy(o, "\"", 1);
+	/* same escapes as kjson_value_print() */
+	char *w = iov_reserve(o, 2 + (esc ? 6 : 1) * s->len), *v = w;
+	if (!w)
+		return false;
+	*w++ = '"';
+	if (!esc) {
+		memcpy(w, s->begin, s->len);
+		w += s->len;
+	} else
+		for (size_t i=0; i<s->len; i++) {
+			char c = s->begin[i];
+			if (c == '"' || c == '\\') {
+				*w++ = '\\';
+				*w++ = c;
+			} else if ((unsigned char)c <= 0x1f) {
+				static const char hex[] = "0123456789abcdef";
+				memcpy(w, "\\u00", 4);
+				w[4] = hex[c >> 4];
+				w[5] = hex[c & 0xf];
+				w += 6;
+			} else
+				*w++ = c;
+		}
+	*w++ = '"';
+	return iov_commit(o, w - v);
+}
+
+bool kjson_value_iov(struct kjson_iov *o, const struct kjson_value *v)
+{
+	switch (v->type) {
+	case KJSON_VALUE_NULL:
+		return iov_copy(o, "null", 4);
+	case KJSON_VALUE_BOOLEAN:
+		return v->b ? iov_copy(o, "true", 4) : iov_copy(o, "false", 5);
+	case KJSON_VALUE_NUMBER: {
+		size_t n = v->n.end - v->n.integer;
+		return n > IOV_INLINE ? iov_push(o, v->n.integer, n)
+		                      : iov_copy(o, v->n.integer, n);
+	}
+	case KJSON_VALUE_STRING:
+	case KJSON_VALUE_STRING_ESCAPED:
+		return iov_string(o, &v->s,
+		                  v->type == KJSON_VALUE_STRING_ESCAPED);
+	case KJSON_VALUE_ARRAY:
+		if (!iov_copy(o, "[", 1))
+			return false;
+		for (size_t i=0; i<v->a.n; i++)
+			if ((i && !iov_copy(o, ",", 1)) ||
+			    !kjson_value_iov(o, &v->a.data[i]))
+				return false;
+		return iov_copy(o, "]", 1);
+	case KJSON_VALUE_OBJECT:
+		if (!iov_copy(o, "{", 1))
+			return false;
+		for (size_t i=0; i<v->o.n; i++)
+			if ((i && !iov_copy(o, ",", 1)) ||
+			    !iov_string(o, &v->o.data[i].key, v->o.raw_keys) ||
+			    !iov_copy(o, ":", 1) ||
+			    !kjson_value_iov(o, &v->o.data[i].value))
+				return false;
+		return iov_copy(o, "}", 1);
+	default:
+		return false;
+	}
+}
+
+bool kjson_iov_write(int fd, const struct kjson_iov *o)
+{
+	struct iovec iov[WRITE_IOV];
+	for (size_t i=0; i<o->n;) {
+		size_t k = o->n - i < WRITE_IOV ? o->n - i : WRITE_IOV;
+		memcpy(iov, o->iov + i, k * sizeof(*iov));
+		if (!write_all(fd, iov, k))
+			return false;
+		i += k;
+	}
+	return true;
+}
+
+void kjson_iov_fini(struct kjson_iov *o)
+{
+	for (struct kjson_iov_block *b = o->blocks, *next; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+	free(o->iov);
+}
+
+/* --------------------------------------------------------------------------
+ * parallel schema inference
+ * -------------------------------------------------------------------------- */
+
+/* NDJSON input is split into chunks of about SCHEMA_GRAIN bytes ending at a
+ * newline, which the threads claim one after the other. */
+#define SCHEMA_GRAIN		(1 << 20)
+
+struct schema_pool {
+	char *buf;
+	/* chunk i is buf[bounds[i]..bounds[i+1]-1] */
+	size_t *bounds;
+	size_t n_chunks;
+	atomic_size_t next;
+};
+
+struct schema_worker {
+	struct schema_pool *pool;
+	struct kjson_schema s;
+	bool oom;
+	pthread_t tid;
+};
+
+/* Adds the lines in b[0..e-b-1] to *s, e[0] is '\n' or the final '\0'. */
+static bool schema_lines(struct kjson_schema *s, char *b, char *e)
+{
+	for (char *nl; b <= e; b = nl + 1) {
+		if (!(nl = memchr(b, '\n', e - b)))
+			nl = e;
+		*nl = '\0';
+		struct kjson_parser p = { .s = b };
+		kjson_skip_space(&p);
+		if (!*p.s)
+			continue;
+		size_t errors = s->errors;
+		if (kjson_schema_add(s, &p)) {
+			kjson_skip_space(&p);
+			if (*p.s) {
+				/* trailing garbage */
+				s->docs--;
+				s->errors++;
+			}
+		} else if (s->errors == errors)
+			return false;
+	}
+	return true;
+}
+
+static void * schema_worker(void *arg)
+{
+	struct schema_worker *w = arg;
+	struct schema_pool *pool = w->pool;
+	for (size_t i; !w->oom &&
+	               (i = atomic_fetch_add(&pool->next, 1)) < pool->n_chunks;) {
+		char *b = pool->buf + pool->bounds[i];
+		char *e = pool->buf + pool->bounds[i+1] - 1;
+		w->oom = !schema_lines(&w->s, b, e);
+	}
+	return NULL;
+}
+
+bool kjson_schema_ndjson(struct kjson_schema *s, char *buf, size_t len,
+                         unsigned nthreads)
+{
+	struct schema_pool pool = {
+		.buf      = buf,
+		.n_chunks = len / SCHEMA_GRAIN + 1,
+	};
+	atomic_init(&pool.next, 0);
+	unsigned n = n_threads(nthreads);
+	if (n > pool.n_chunks)
+		n = pool.n_chunks;
+	pool.bounds = malloc((pool.n_chunks + 1) * sizeof(*pool.bounds));
+	struct schema_worker *w = calloc(n, sizeof(*w));
+	bool r = pool.bounds && w;
+	if (r) {
+		/* let each chunk but the last end just after a '\n' and the last
+		 * one just after the final '\0' */
+		size_t k = 0;
+		pool.bounds[0] = 0;
+		for (size_t i=1; i<pool.n_chunks; i++) {
+			size_t at = i * SCHEMA_GRAIN;
+			if (at < pool.bounds[k])
+				continue;
+			char *nl = memchr(buf + at, '\n', len - at);
+			if (!nl)
+				break;
+			pool.bounds[++k] = nl + 1 - buf;
+		}
+		pool.bounds[++k] = len + 1;
+		pool.n_chunks = k;
+		for (unsigned i=0; i<n; i++) {
+			w[i].pool = &pool;
+			w[i].s = (struct kjson_schema)KJSON_SCHEMA_INIT;
+		}
+		/* the calling thread is worker 0; if threads cannot be created,
+		 * the others do their work */
+		unsigned started = 1;
+		for (; started<n; started++)
+			if (pthread_create(&w[started].tid, NULL, schema_worker,
+			                   &w[started]))
+				break;
+		schema_worker(&w[0]);
+		for (unsigned i=1; i<started; i++)
+			pthread_join(w[i].tid, NULL);
+		for (unsigned i=0; i<n; i++) {
+			if (w[i].oom || !kjson_schema_merge(s, &w[i].s))
+				r = false;
+			kjson_schema_fini(&w[i].s);
+		}
+	}
+	free(w);
+	free(pool.bounds);
+	return r;
+}
+
+/* --------------------------------------------------------------------------
+ * parallel parsing of document sequences
+ * -------------------------------------------------------------------------- */
+
+/* Number of documents claimed by a thread at once. */
+#define MANY_BATCH		64
+/* The string scans of kjson.c read whole aligned words and thus up to
+ * sizeof(unsigned long)-1 bytes past the end of a document. So that these
+ * reads do not race with another thread decoding the next document in place,
+ * the documents in the last MANY_GAP bytes of each batch are only parsed after
+ * all threads finished. */
+#define MANY_GAP		sizeof(unsigned long)
+
+struct many_pool {
+	char *buf;
+	/* document i is at buf[starts[i]], starts[n] is the length */
+	size_t *starts;
+	size_t n;
+	const struct kjson_many_cb *c;
+	unsigned flags;
+	atomic_size_t next;
+	/* smallest index of a document that failed to parse */
+	atomic_size_t fail;
+};
+
+/* Stores the offsets of the documents in buf[0..len-1] in pool->starts.
+ * Returns false if memory could not be allocated or, after setting pool->n to
+ * its index, if a document could not be delimited. */
+static bool many_split(struct many_pool *pool, size_t len, bool *oom)
+{
+	char *end = pool->buf + len;
+	size_t cap = 0;
+	for (char *s = pool->buf;; pool->n++) {
+		if (pool->n + 1 >= cap) {
+			cap = cap ? 2 * cap : 1024;
+			void *t = realloc(pool->starts, cap * sizeof(*pool->starts));
+			if (!t) {
+				*oom = true;
+				return false;
+			}
+			pool->starts = t;
+		}
+		if ((s = kjson_skip_separators(s, end)) == end)
+			break;
+		pool->starts[pool->n] = s - pool->buf;
+		struct kjson_parser p = { .s = s };
+		size_t k;
+		if (!(*s == '[' || *s == '{' ? kjson_count_elements(&p, &k)
+		                             : kjson_skip(&p)) || p.s > end)
+			return false;
+		s = p.s;
+	}
+	pool->starts[pool->n] = len;
+	return true;
+}
+
+static void many_fail(struct many_pool *pool, size_t i)
+{
+	size_t f = atomic_load(&pool->fail);
+	while (i < f && !atomic_compare_exchange_weak(&pool->fail, &f, i));
+}
+
+static void many_parse(struct many_pool *pool, size_t lo, size_t hi)
+{
+	for (size_t i=lo; i<hi && i<atomic_load(&pool->fail); i++) {
+		char *s = pool->buf + pool->starts[i];
+		struct kjson_parser p = { .s = s, .flags = pool->flags };
+		if (!pool->c->doc(pool->c, &p, i) || p.s == s ||
+		    p.s > pool->buf + pool->starts[i+1])
+			many_fail(pool, i);
+	}
+}
+
+/* Returns the index of the first document of the batch starting at lo which
+ * is deferred, see MANY_GAP. */
+static size_t many_cut(const struct many_pool *pool, size_t lo, size_t *hi)
+{
+	*hi = lo + MANY_BATCH < pool->n ? lo + MANY_BATCH : pool->n;
+	if (*hi == pool->n)
+		return *hi;
+	size_t cut = *hi - 1;
+	while (cut > lo && pool->starts[*hi] - pool->starts[cut] < MANY_GAP)
+		cut--;
+	return cut;
+}
+
+static void * many_worker(void *arg)
+{
+	struct many_pool *pool = arg;
+	for (size_t lo, hi; (lo = atomic_fetch_add(&pool->next, MANY_BATCH)) <
+	                    pool->n;)
+		many_parse(pool, lo, many_cut(pool, lo, &hi));
+	return NULL;
+}
+
+bool kjson_parse_many_parallel(char *buf, size_t len,
+                               const struct kjson_many_cb *c, unsigned flags,
+                               unsigned nthreads, size_t *n)
+{
+	struct many_pool pool = {
+		.buf   = buf,
+		.c     = c,
+		.flags = flags,
+	};
+	atomic_init(&pool.next, 0);
+	bool oom = false;
+	PROBE(parse_many_parallel_start, buf, len);
+	if (!many_split(&pool, len, &oom)) {
+		free(pool.starts);
+		*n = oom ? 0 : pool.n;
+		PROBE(parse_many_parallel_end, *n, false);
+		return false;
+	}
+	atomic_init(&pool.fail, pool.n);
+	if (c->count)
+		c->count(c, pool.n);
+	unsigned k = n_threads(nthreads);
+	if (k > (pool.n + MANY_BATCH - 1) / MANY_BATCH)
+		k = (pool.n + MANY_BATCH - 1) / MANY_BATCH;
+	pthread_t *tids = k > 1 ? calloc(k - 1, sizeof(*tids)) : NULL;
+	/* the calling thread is one of the workers; if threads cannot be
+	 * created, the others do their work */
+	unsigned started = 0;
+	for (; tids && started<k-1; started++)
+		if (pthread_create(&tids[started], NULL, many_worker, &pool))
+			break;
+	many_worker(&pool);
+	for (unsigned i=0; i<started; i++)
+		pthread_join(tids[i], NULL);
+	for (size_t lo=0, hi; lo<pool.n; lo+=MANY_BATCH) {
+		size_t cut = many_cut(&pool, lo, &hi);
+		many_parse(&pool, cut, hi);
+	}
+	free(tids);
+	free(pool.starts);
+	*n = atomic_load(&pool.fail);
+	PROBE(parse_many_parallel_end, *n, *n == pool.n);
+	return *n == pool.n;
+}
+
+/* --------------------------------------------------------------------------
+ * pipelined NDJSON reader
+ * -------------------------------------------------------------------------- */
+
+/* Size and number of the blocks read ahead. */
+#define FD_BLOCK		(1 << 18)
+#define FD_SLOTS		8
+#define FD_ALIGN		4096
+
+struct fd_slot {
+	char *data;
+	/* 0 marks the end of the input */
+	size_t len;
+	bool full;
+};
+
+struct fd_ring {
+	int fd;
+	struct fd_slot slot[FD_SLOTS];
+	pthread_mutex_t mtx;
+	pthread_cond_t not_full, not_empty;
+	/* set by the consumer to stop the reader early */
+	bool stop;
+	/* errno of a failed read(2) */
+	int err;
+};
+
+static void * fd_reader(void *arg)
+{
+	struct fd_ring *ring = arg;
+	for (unsigned i=0;; i = (i + 1) % FD_SLOTS) {
+		struct fd_slot *s = &ring->slot[i];
+		pthread_mutex_lock(&ring->mtx);
+		while (s->full && !ring->stop)
+			pthread_cond_wait(&ring->not_full, &ring->mtx);
+		bool stop = ring->stop;
+		pthread_mutex_unlock(&ring->mtx);
+		if (stop)
+			break;
+		size_t len = 0;
+		int err = 0;
+		while (len < FD_BLOCK) {
+			ssize_t rd = read(ring->fd, s->data + len, FD_BLOCK - len);
+			if (rd > 0)
+				len += rd;
+			else if (!rd)
+				break;
+			else if (errno != EINTR) {
+				err = errno;
+				len = 0;
+				break;
+			}
+		}
+		pthread_mutex_lock(&ring->mtx);
+		s->len = len;
+		s->full = true;
+		ring->err = err;
+		pthread_cond_signal(&ring->not_empty);
+		pthread_mutex_unlock(&ring->mtx);
+		if (!len)
+			break;
+	}
+	return NULL;
+}
+
+/* State of the consumer: the partial line carried over to the next block is
+ * carry[0..carry_len-1]. */
+struct fd_lines {
+	const struct kjson_many_cb *c;
+	unsigned flags;
+	size_t *n;
+	char *carry;
+	size_t carry_len, carry_cap;
+	/* errno in case of a failure other than a syntax error */
+	int err;
+};
+
+/* Parses the '\0'-terminated line l unless it is blank. */
+static bool fd_line(struct fd_lines *st, char *l)
+{
+	struct kjson_parser p = { .s = l, .flags = st->flags };
+	kjson_skip_space(&p);
+	if (!*p.s)
+		return true;
+	if (!st->c->doc(st->c, &p, *st->n))
+		return false;
+	kjson_skip_space(&p);
+	if (*p.s)
+		return false;
+	++*st->n;
+	return true;
+}
+
+/* Appends b[0..k-1] to the carried line, leaving room for a '\0'. */
+static bool fd_carry(struct fd_lines *st, const char *b, size_t k)
+{
+	if (!k)
+		return true;
+	if (st->carry_len + k + 1 > st->carry_cap) {
+		size_t cap = 2 * (st->carry_len + k + 1);
+		char *t = realloc(st->carry, cap);
+		if (!t) {
+			st->err = ENOMEM;
+			return false;
+		}
+		st->carry = t;
+		st->carry_cap = cap;
+	}
+	memcpy(st->carry + st->carry_len, b, k);
+	st->carry_len += k;
+	return true;
+}
+
+/* Parses the lines in the block b[0..e-b-1], the first of which continues the
+ * carried line and the last of which is carried over unless it ends in
+ * '\n'. */
+static bool fd_block(struct fd_lines *st, char *b, char *e)
+{
+	char *nl = memchr(b, '\n', e - b);
+	if (st->carry_len || !nl) {
+		if (!fd_carry(st, b, (nl ? nl : e) - b))
+			return false;
+		if (!nl)
+			return true;
+		st->carry[st->carry_len] = '\0';
+		st->carry_len = 0;
+		if (!fd_line(st, st->carry))
+			return false;
+		b = nl + 1;
+	}
+	/* lines completely contained in the block are parsed in place */
+	for (; b < e && (nl = memchr(b, '\n', e - b)); b = nl + 1) {
+		*nl = '\0';
+		if (!fd_line(st, b))
+			return false;
+	}
+	return fd_carry(st, b, e - b);
+}
+
+bool kjson_parse_fd(int fd, const struct kjson_many_cb *c, unsigned flags,
+                    size_t *n)
+{
+	struct fd_ring ring = { .fd = fd };
+	struct fd_lines st = { .c = c, .flags = flags, .n = n };
+	bool r = false;
+	*n = 0;
+	PROBE(parse_fd_start, fd);
+	for (unsigned i=0; i<FD_SLOTS; i++)
+		if ((st.err = posix_memalign((void **)&ring.slot[i].data,
+		                             FD_ALIGN, FD_BLOCK)))
+			goto done;
+	pthread_mutex_init(&ring.mtx, NULL);
+	pthread_cond_init(&ring.not_full, NULL);
+	pthread_cond_init(&ring.not_empty, NULL);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	pthread_t tid;
+	if ((st.err = pthread_create(&tid, NULL, fd_reader, &ring)))
+		goto fini;
+	for (unsigned i=0;; i = (i + 1) % FD_SLOTS) {
+		struct fd_slot *s = &ring.slot[i];
+		pthread_mutex_lock(&ring.mtx);
+		while (!s->full)
+			pthread_cond_wait(&ring.not_empty, &ring.mtx);
+		pthread_mutex_unlock(&ring.mtx);
+		if (!s->len) {
+			if (!(st.err = ring.err) && st.carry_len) {
+				/* last line without '\n' */
+				st.carry[st.carry_len] = '\0';
+				r = fd_line(&st, st.carry);
+			} else
+				r = !st.err;
+			break;
+		}
+		if (!fd_block(&st, s->data, s->data + s->len))
+			break;
+		pthread_mutex_lock(&ring.mtx);
+		s->full = false;
+		pthread_cond_signal(&ring.not_full);
+		pthread_mutex_unlock(&ring.mtx);
+	}
+	pthread_mutex_lock(&ring.mtx);
+	ring.stop = true;
+	pthread_cond_signal(&ring.not_full);
+	pthread_mutex_unlock(&ring.mtx);
+	pthread_join(tid, NULL);
+fini:
+	pthread_cond_destroy(&ring.not_empty);
+	pthread_cond_destroy(&ring.not_full);
+	pthread_mutex_destroy(&ring.mtx);
+done:
+	for (unsigned i=0; i<FD_SLOTS; i++)
+		free(ring.slot[i].data);
+	free(st.carry);
+	PROBE(parse_fd_end, *n, r);
+	errno = st.err;
+	return r;
+}
+
+/* --------------------------------------------------------------------------
+ * batch processing of files
+ * -------------------------------------------------------------------------- */
+
+/* Files of at least BATCH_MMAP_MIN bytes are mapped into memory. */
+#define BATCH_MMAP_MIN		(1 << 20)
+/* Number of files stat'ed by a thread at once. */
+#define BATCH_STAT_GRAIN	256
+
+struct batch_job {
+	size_t size, idx;
+};
+
+struct batch_pool {
+	struct kjson_batch_file *files;
+	size_t n;
+	/* files in the order to be processed */
+	struct batch_job *jobs;
+	const struct kjson_batch_cb *c;
+	atomic_size_t next;
+	long page;
+};
+
+struct batch_worker {
+	struct batch_pool *pool;
+	void *ctx;
+	char *buf;
+	size_t cap;
+	pthread_t tid;
+};
+
+static double batch_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void * batch_stat(void *arg)
+{
+	struct batch_worker *w = arg;
+	struct batch_pool *pool = w->pool;
+	for (size_t lo; (lo = atomic_fetch_add(&pool->next, BATCH_STAT_GRAIN)) <
+	                pool->n;)
+		for (size_t i=lo; i<lo+BATCH_STAT_GRAIN && i<pool->n; i++) {
+			struct kjson_batch_file *f = &pool->files[i];
+			struct stat st;
+			if (f->size)
+				;
+			else if (stat(f->path, &st))
+				f->err = errno;
+			else
+				f->size = st.st_size;
+		}
+	return NULL;
+}
+
+/* Processes *f, whose size is given by fstat(2) on fd. */
+static void batch_file(struct batch_worker *w, struct kjson_batch_file *f,
+                       int fd)
+{
+	const struct kjson_batch_cb *c = w->pool->c;
+	struct stat st;
+	if (fstat(fd, &st)) {
+		f->err = errno;
+		return;
+	}
+	size_t len = f->size = st.st_size;
+	char *data;
+	/* beyond the end of a file, the rest of its last page reads as 0 */
+	bool map = len >= BATCH_MMAP_MIN && len % w->pool->page;
+	if (map) {
+		data = mmap(NULL, len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		            fd, 0);
+		if (data == MAP_FAILED) {
+			f->err = errno;
+			return;
+		}
+	} else {
+		if (len + 1 > w->cap) {
+			free(w->buf);
+			w->cap = len + 1 > 2 * w->cap ? len + 1 : 2 * w->cap;
+			if (!(w->buf = malloc(w->cap))) {
+				w->cap = 0;
+				f->err = ENOMEM;
+				return;
+			}
+		}
+		data = w->buf;
+		size_t k = 0;
+		while (k < len) {
+			ssize_t rd = read(fd, data + k, len - k);
+			if (rd > 0)
+				k += rd;
+			else if (!rd)
+				break;
+			else if (errno != EINTR) {
+				f->err = errno;
+				return;
+			}
+		}
+		data[len = k] = '\0';
+	}
+	struct kjson_parser p = { .s = data };
+	f->ok = c->file(c, &p, len, f, w->ctx);
+	if (map)
+		munmap(data, len + 1);
+}
+
+static void * batch_worker(void *arg)
+{
+	struct batch_worker *w = arg;
+	struct batch_pool *pool = w->pool;
+	for (size_t i; (i = atomic_fetch_add(&pool->next, 1)) < pool->n;) {
+		struct kjson_batch_file *f = &pool->files[pool->jobs[i].idx];
+		if (f->err)
+			continue;
+		double t = batch_now();
+		int fd = open(f->path, O_RDONLY);
+		if (fd == -1)
+			f->err = errno;
+		else {
+			batch_file(w, f, fd);
+			close(fd);
+		}
+		f->seconds = batch_now() - t;
+	}
+	return NULL;
+}
+
+static int batch_cmp(const void *a, const void *b)
+{
+	const struct batch_job *x = a, *y = b;
+	return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+/* Runs fun on all workers, the calling thread being w[0]; if threads cannot be
+ * created, the others do their work. */
+static void batch_run(struct batch_worker *w, unsigned n, void *(*fun)(void *))
+{
+	atomic_store(&w->pool->next, 0);
+	unsigned started = 1;
+	for (; started<n; started++)
+		if (pthread_create(&w[started].tid, NULL, fun, &w[started]))
+			break;
+	fun(&w[0]);
+	for (unsigned i=1; i<started; i++)
+		pthread_join(w[i].tid, NULL);
+}
+
+bool kjson_batch(struct kjson_batch_file *files, size_t n,
+                 const struct kjson_batch_cb *c, unsigned nthreads,
+                 struct kjson_batch_stats *st)
+{
+	double t = batch_now();
+	PROBE(batch_start, n);
+	struct batch_pool pool = {
+		.files = files,
+		.n     = n,
+		.jobs  = malloc(n * sizeof(*pool.jobs)),
+		.c     = c,
+		.page  = sysconf(_SC_PAGESIZE),
+	};
+	atomic_init(&pool.next, 0);
+	unsigned k = n_threads(nthreads);
+	struct batch_worker *w = calloc(k, sizeof(*w));
+	bool r = w && (pool.jobs || !n);
+	unsigned i;
+	for (i=0; r && i<k; i++) {
+		w[i].pool = &pool;
+		if (c->ctx_size && !(w[i].ctx = calloc(1, c->ctx_size)))
+			r = false;
+	}
+	if (r) {
+		for (size_t j=0; j<n; j++) {
+			files[j].ok = false;
+			files[j].err = 0;
+			files[j].seconds = 0;
+		}
+		batch_run(w, k, batch_stat);
+		for (size_t j=0; j<n; j++)
+			pool.jobs[j] = (struct batch_job){ files[j].size, j };
+		qsort(pool.jobs, n, sizeof(*pool.jobs), batch_cmp);
+		batch_run(w, k, batch_worker);
+	}
+	for (unsigned j=0; j<i; j++) {
+		if (r && c->fini)
+			c->fini(c, w[j].ctx);
+		free(w[j].ctx);
+		free(w[j].buf);
+	}
+	free(w);
+	free(pool.jobs);
+	if (r && st) {
+		*st = (struct kjson_batch_stats){ .files = n };
+		for (size_t j=0; j<n; j++) {
+			st->failed += !files[j].ok;
+			st->bytes += files[j].size;
+		}
+		st->seconds = batch_now() - t;
+	}
+	PROBE(batch_end, n, r);
+	return r;
+}
+
+static bool batch_add(struct kjson_batch_file **files, size_t *n,
+                      const char *path, size_t size)
+{
+	/* capacities are powers of 2 */
+	if (*n >= 16 ? !(*n & (*n - 1)) : !*n) {
+		void *t = realloc(*files, (*n ? 2 * *n : 16) * sizeof(**files));
+		if (!t)
+			return false;
+		*files = t;
+	}
+	char *p = malloc(strlen(path) + 1);
+	if (!p)
+		return false;
+	strcpy(p, path);
+	(*files)[(*n)++] = (struct kjson_batch_file){ .path = p, .size = size };
+	return true;
+}
+
+/* Entries of directories are not followed if they are symbolic links to
+ * directories, which prevents cycles. */
+static bool batch_collect(const char *path, struct kjson_batch_file **files,
+                          size_t *n, bool follow_dirs)
+{
+	struct stat st;
+	if (follow_dirs ? stat(path, &st) : lstat(path, &st))
+		return false;
+	if (S_ISLNK(st.st_mode)) {
+		if (stat(path, &st))
+			return true; /* dangling */
+		if (S_ISDIR(st.st_mode))
+			return true;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return !S_ISREG(st.st_mode) || batch_add(files, n, path,
+		                                         st.st_size);
+	DIR *d = opendir(path);
+	if (!d)
+		return false;
+	size_t len = strlen(path);
+	char *sub = NULL;
+	bool r = true;
+	for (struct dirent *e; r && (errno = 0, e = readdir(d));) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+		char *t = realloc(sub, len + strlen(e->d_name) + 2);
+		if (!(r = t))
+			break;
+		sub = t;
+		sprintf(sub, "%s/%s", path, e->d_name);
+		r = batch_collect(sub, files, n, false);
+	}
+	if (r && errno)
+		r = false; /* readdir(3p) failed */
+	int err = errno;
+	free(sub);
+	closedir(d);
+	errno = err;
+	return r;
+}
+
+bool kjson_batch_collect(const char *path, struct kjson_batch_file **files,
+                         size_t *n)
+{
+	return batch_collect(path, files, n, true);
+}
+
+void kjson_batch_free(struct kjson_batch_file *files, size_t n)
+{
+	for (size_t i=0; i<n; i++)
+		free(files[i].path);
+	free(files);
+}
@@ -0,0 +1,101 @@
+/*
+ * kjson-schema.c
+ *
+ * Copyright 2019-2020 Franz Brauße <brausse@informatik.uni-trier.de>
+ *
+ * This file is part of kjson.
+ * See the LICENSE file for terms of distribution.
+ */
+
+/* Requires C11 (for anonymous struct / union members)
+ * and      _POSIX_C_SOURCE >= 200809L
+ *
+ * Reads NDJSON, i.e., one JSON document per line, from the given files or
+ * stdin and writes the schema inferred by kjson_schema_ndjson() to stdout,
+ * see kjson_schema_print() for its format. The input is read in blocks of the
+ * size given by option -b (in MiB), each of which is processed in one
+ * parallel pass by the number of threads given by option -j; thus, memory
+ * use does not depend on the size of the input. Lines longer than a block
+ * enlarge it.
+ */
+
+#include <stdio.h>	/* fprintf(3), perror(3) */
+#include <stdlib.h>	/* exit(3), malloc(3), free(3), strtoul(3) */
+#include <string.h>	/* memchr(3), memmove(3) */
+#include <fcntl.h>	/* open(3p) */
+#include <unistd.h>	/* getopt(3), read(3p), close(3p) */
+
+#include "kjson.h"
+
+#define DIE(code,...) do { fprintf(stderr, __VA_ARGS__); exit(code); } while (0)
+
+static void infer(struct kjson_schema *s, int fd, char **buf, size_t *cap,
+                  unsigned nthreads, const char *name)
+{
+	size_t len = 0;
+	for (ssize_t rd;; len += rd) {
+		if (len == *cap) {
+			*cap *= 2;
+			if (!(*buf = realloc(*buf, *cap + 1)))
+				DIE(2,"error: out of memory\n");
+		}
+		if ((rd = read(fd, *buf + len, *cap - len)) < 0) {
+			perror(name);
+			exit(2);
+		}
+		if (!rd)
+			break;
+		/* process the complete lines, keep the rest for the next block */
+		char *end = *buf + len + rd, *nl = end;
+		while (nl > *buf + len && nl[-1] != '\n')
+			nl--;
+		if (nl == *buf + len)
+			continue;
+		nl[-1] = '\0';
+		if (!kjson_schema_ndjson(s, *buf, nl - 1 - *buf, nthreads))
+			DIE(2,"error: out of memory\n");
+		memmove(*buf, nl, end - nl);
+		len = 0;
+		rd = end - nl;
+	}
+	(*buf)[len] = '\0';
+	if (!kjson_schema_ndjson(s, *buf, len, nthreads))
+		DIE(2,"error: out of memory\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned nthreads = 0;
+	size_t block = 64;
+	for (int opt; (opt = getopt(argc, argv, ":b:hj:")) != -1;)
+		switch (opt) {
+		case 'b': block = strtoul(optarg, NULL, 10); break;
+		case 'h': DIE(1,"usage: %s [-b BLOCK_MIB] [-j THREADS] "
+			        "[FILE...]\n", argv[0]);
+		case 'j': nthreads = strtoul(optarg, NULL, 10); break;
+		case ':': DIE(1,"error: option '-%c' requires a parameter\n",
+			        optopt);
+		case '?': DIE(1,"error: unknown option '-%c'\n", optopt);
+		}
+	size_t cap = (block ? block : 1) << 20;
+	char *buf = malloc(cap + 1);
+	if (!buf)
+		DIE(2,"error: out of memory\n");
+
+	struct kjson_schema s = KJSON_SCHEMA_INIT;
+	if (optind == argc)
+		infer(&s, STDIN_FILENO, &buf, &cap, nthreads, "<stdin>");
+	for (int i=optind; i<argc; i++) {
+		int fd = open(argv[i], O_RDONLY);
+		if (fd == -1) {
+			perror(argv[i]);
+			exit(2);
+		}
+		infer(&s, fd, &buf, &cap, nthreads, argv[i]);
+		close(fd);
+	}
+	kjson_schema_print(stdout, &s);
+	kjson_schema_fini(&s);
+	free(buf);
+	return 0;
+}
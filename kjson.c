@@ -15,12 +15,152 @@
 #include <errno.h>	/* errno(3) */
 #include <assert.h>	/* assert(3) */
 #include <limits.h>	/* CHAR_BIT */
-#include <math.h>	/* ldexp() */
 
 #include "kjson.h"
 
+#ifdef KJSON_IMPLEMENTATION
+/* kjson.h includes this file into the user's translation unit: file-scope
+ * names outside the kjson_ namespace get a prefix. These and the other macros
+ * defined in this file are removed again at its end, where any new ones have
+ * to be added as well; 'make check' finds those missing. */
+# define b64_dec		kjson__b64_dec
+# define compact		kjson__compact
+# define compact_bytes		kjson__compact_bytes
+# define compact_copy		kjson__compact_copy
+# define compact_size		kjson__compact_size
+# define count_upto		kjson__count_upto
+# define decode_escape		kjson__decode_escape
+# define elem			kjson__elem
+# define ensure_one_left	kjson__ensure_one_left
+# define error_messages		kjson__error_messages
+# define fail			kjson__fail
+# define hex4			kjson__hex4
+# define high_a_entry		kjson__high_a_entry
+# define high_begin		kjson__high_begin
+# define high_cb		kjson__high_cb
+# define high_end		kjson__high_end
+# define high_leaf		kjson__high_leaf
+# define high_o_entry		kjson__high_o_entry
+# define is_hex			kjson__is_hex
+# define parse_mid2		kjson__parse_mid2
+# define plan_add		kjson__plan_add
+# define plan_value		kjson__plan_value
+# define print_close		kjson__print_close
+# define print_entries		kjson__print_entries
+# define print_head		kjson__print_head
+# define print_open		kjson__print_open
+# define print_plan		kjson__print_plan
+# define print_string		kjson__print_string
+# define proj_build		kjson__proj_build
+# define proj_child		kjson__proj_child
+# define proj_copy		kjson__proj_copy
+# define proj_node		kjson__proj_node
+# define proj_seg_eq		kjson__proj_seg_eq
+# define proj_value		kjson__proj_value
+# define read_string		kjson__read_string
+# define redact_key		kjson__redact_key
+# define redact_value		kjson__redact_value
+# define schema_a_entry		kjson__schema_a_entry
+# define schema_begin		kjson__schema_begin
+# define schema_cb		kjson__schema_cb
+# define schema_child		kjson__schema_child
+# define schema_count		kjson__schema_count
+# define schema_end		kjson__schema_end
+# define schema_frame		kjson__schema_frame
+# define schema_hash		kjson__schema_hash
+# define schema_hll_add		kjson__schema_hll_add
+# define schema_hll_estimate	kjson__schema_hll_estimate
+# define schema_indent		kjson__schema_indent
+# define schema_items		kjson__schema_items
+# define schema_key_is		kjson__schema_key_is
+# define schema_leaf		kjson__schema_leaf
+# define schema_len		kjson__schema_len
+# define schema_len_add		kjson__schema_len_add
+# define schema_len_merge	kjson__schema_len_merge
+# define schema_len_print	kjson__schema_len_print
+# define schema_ln		kjson__schema_ln
+# define schema_node_free	kjson__schema_node_free
+# define schema_node_merge	kjson__schema_node_merge
+# define schema_node_new	kjson__schema_node_new
+# define schema_node_print	kjson__schema_node_print
+# define schema_o_entry		kjson__schema_o_entry
+# define schema_type		kjson__schema_type
+# define schema_type_names	kjson__schema_type_names
+# define skip_leaf		kjson__skip_leaf
+# define skip_space		kjson__skip_space
+# define skip_string		kjson__skip_string
+# define str_pat		kjson__str_pat
+# define str_special		kjson__str_special
+# define str_special_n		kjson__str_special_n
+# define str_subst1		kjson__str_subst1
+# define top			kjson__top
+# define validate		kjson__validate
+# define validate_digits	kjson__validate_digits
+# define validate_fail		kjson__validate_fail
+# define validate_key		kjson__validate_key
+# define validate_number	kjson__validate_number
+# define validate_space		kjson__validate_space
+# define validate_string	kjson__validate_string
+# define validate_uescape	kjson__validate_uescape
+# define validate_utf8_seq	kjson__validate_utf8_seq
+# define SCHEMA_ARRAY		kjson__SCHEMA_ARRAY
+# define SCHEMA_BOOLEAN		kjson__SCHEMA_BOOLEAN
+# define SCHEMA_INTEGER		kjson__SCHEMA_INTEGER
+# define SCHEMA_N		kjson__SCHEMA_N
+# define SCHEMA_NULL		kjson__SCHEMA_NULL
+# define SCHEMA_NUMBER		kjson__SCHEMA_NUMBER
+# define SCHEMA_OBJECT		kjson__SCHEMA_OBJECT
+# define SCHEMA_STRING		kjson__SCHEMA_STRING
+#endif
+
 uint32_t kjson_version(void) { return KJSON_VERSION; }
 
+#ifdef __GNUC__
+# define COLD	__attribute__((cold,noinline))
+#else
+# define COLD
+#endif
+
+/* Static tracepoints for SystemTap or bpftrace, see kjson.bt. Built only if
+ * KJSON_USDT is defined; until a tracer attaches, each one is a single NOP. */
+#ifdef KJSON_USDT
+# include <sys/sdt.h>
+# define PROBE(...)	STAP_PROBEV(kjson, __VA_ARGS__)
+#else
+# define PROBE(...)	((void)0)
+#endif
+
+static const char *const error_messages[KJSON_ERR_N] = {
+	[KJSON_ERR_NONE    ] = "no error",
+	[KJSON_ERR_EOF     ] = "unexpected end of input",
+	[KJSON_ERR_VALUE   ] = "expected a value",
+	[KJSON_ERR_NUMBER  ] = "invalid number",
+	[KJSON_ERR_STRING  ] = "expected a string",
+	[KJSON_ERR_CONTROL ] = "control character in string",
+	[KJSON_ERR_ESCAPE  ] = "invalid escape sequence",
+	[KJSON_ERR_COLON   ] = "expected ':'",
+	[KJSON_ERR_COMMA   ] = "expected ',' or end of composite",
+	[KJSON_ERR_UTF8    ] = "invalid UTF-8",
+	[KJSON_ERR_DEPTH   ] = "nesting too deep",
+	[KJSON_ERR_TRAILING] = "trailing characters after value",
+};
+
+const char * kjson_strerror(enum kjson_error err)
+{
+	return (unsigned)err < KJSON_ERR_N ? error_messages[err]
+	                                   : "unknown error";
+}
+
+/* Records the syntax error err detected at 'at' in *p and returns false. Only
+ * called on failure, thus kept out of line. */
+static COLD bool fail(struct kjson_parser *p, enum kjson_error err,
+                      const char *at)
+{
+	p->error = *at ? err : KJSON_ERR_EOF;
+	p->error_at = at;
+	return false;
+}
+
 /* --------------------------------------------------------------------------
  * low-level interface
  * -------------------------------------------------------------------------- */
@@ -72,10 +212,10 @@ static const char str_pat   [] = "\"\\/bfnrtu";
 
 /* Decodes escape sequence(s) at p->s into *r and advances both, p->s and *r
  * to reflect the amount read and written, respectively. p->s and *r are
- * assumed to point to UTF-8 strings, in which case escaped(r, p) is just
+ * assumed to point to UTF-8 strings, in which case decode_escape(r, p) is just
  * appending the corresponding JSON-escaped code-point to *r. See README.md
  * for details. */
-static bool escaped(char **r, struct kjson_parser *p)
+static bool decode_escape(char **r, struct kjson_parser *p)
 {
 	const char *at = strchr(str_pat, *p->s);
 	if (!at)
@@ -127,70 +267,69 @@ static bool escaped(char **r, struct kjson_parser *p)
 #define XCONCAT(a,b)	CONCAT(a,b)
 
 #if CHAR_BIT == 8
-# ifndef LONG_BIT
-#  if ULONG_MAX == 0xffffffff
-#   define LONG_BIT		32
-#  elif ULONG_MAX == 0xffffffffffffffff
-#   define LONG_BIT		64
-#  endif
+# if ULONG_MAX == 0xffffffff
+#  define UL_BITS		32
+# elif ULONG_MAX == 0xffffffffffffffff
+#  define UL_BITS		64
 # endif
-# ifdef LONG_BIT
-#  define UL_REPEATED8(v)	XCONCAT(REPEATED8_,LONG_BIT)((unsigned long)(v))
+# ifdef UL_BITS
+#  define UL_REPEATED8(v)	XCONCAT(REPEATED8_,UL_BITS)((unsigned long)(v))
 # endif
 #endif
 
-bool kjson_read_string_utf8(struct kjson_parser *p, char **begin, size_t *len)
+/* Returns a pointer to the first '"', '\\' or ASCII control character in s. */
+static char * str_special(char *s)
 {
-	if (*p->s != '"')
-		return false;
-	p->s++; /* skip '"' */
-	*begin = p->s;
-	char *end;
 #ifndef UL_REPEATED8
 	/* quite fast search (in case padding bits exist in unsigned long) */
-	for (;; p->s++) {
-		if (*p->s == '"' || *p->s == '\\')
-			goto escape;
-		if ((unsigned char)*p->s <= 0x1f)
-			return false;
+	while (*s != '"' && *s != '\\' && (unsigned char)*s > 0x1f)
+		s++;
+	return s;
 #else
 	/* slow search until pointer is aligned */
-	for (; (uintptr_t)p->s % sizeof(unsigned long); p->s++) {
-		if (*p->s == '"' || *p->s == '\\')
-			goto escape;
-		if ((unsigned char)*p->s <= 0x1f)
-			return false;
-	}
+	for (; (uintptr_t)s % sizeof(unsigned long); s++)
+		if (*s == '"' || *s == '\\' || (unsigned char)*s <= 0x1f)
+			return s;
 	/* search sizeof(unsigned long) bytes at a time -- trick from
 	 * glibc memchr(3) */
 	for (unsigned long ones = UL_REPEATED8(0x01), high_bits = ones << 7;;
-	     p->s += sizeof(unsigned long)) {
+	     s += sizeof(unsigned long)) {
 		/* x_i < 0x20 -> false
 		 * '"' = 0x22 -> end / break
 		 * '\\' = 0x5c -> escape */
-		unsigned long x = *(unsigned long *)p->s;
+		unsigned long x = *(unsigned long *)s;
 		unsigned long a = x ^ UL_REPEATED8('"');
 		unsigned long b = x ^ UL_REPEATED8('\\');
-		if ((((a - ones) & ~a) | ((b - ones) & ~b)) & high_bits)
-			goto escape;
 		/* mask ASCII control symbols (except DEL = 0x7f, since it's
 		 * allowed in JSON strings) */
 		unsigned long d = x & ~UL_REPEATED8(0x1f);
-		if (((d - ones) & ~d) & high_bits)
-			return false;
+		if ((((a - ones) & ~a) | ((b - ones) & ~b) | ((d - ones) & ~d))
+		    & high_bits)
+			break;
 	}
+	while (*s != '"' && *s != '\\' && (unsigned char)*s > 0x1f)
+		s++;
+	return s;
 #endif
-escape:
-	end = p->s;
+}
+
+bool kjson_read_string_utf8(struct kjson_parser *p, char **begin, size_t *len)
+{
+	if (*p->s != '"')
+		return fail(p, KJSON_ERR_STRING, p->s);
+	p->s++; /* skip '"' */
+	*begin = p->s;
+	p->s = str_special(p->s);
+	char *end = p->s;
 	/* even slower search, replacing escapes (they're always shorter than
 	 * the escape sequence itself) */
 	while (*p->s != '"') {
 		if ((unsigned char)*p->s <= 0x1f)
-			return false;
+			return fail(p, KJSON_ERR_CONTROL, p->s);
 		if (*p->s == '\\') {
-			p->s++;
-			if (!escaped(&end, p))
-				return false;
+			const char *esc = p->s++;
+			if (!decode_escape(&end, p))
+				return fail(p, KJSON_ERR_ESCAPE, esc);
 		} else {
 			if (end != p->s)
 				*end = *p->s;
@@ -204,15 +343,161 @@ escape:
 	return true;
 }
 
+/* Like kjson_read_string_utf8(), but only advances p->s past the string
+ * without decoding it, i.e., the source is left unmodified. Sets *esc if it
+ * contains escape sequences. */
+static bool skip_string(struct kjson_parser *p, bool *esc)
+{
+	if (*p->s != '"')
+		return fail(p, KJSON_ERR_STRING, p->s);
+	p->s++; /* skip '"' */
+	*esc = false;
+	while (*(p->s = str_special(p->s)) == '\\') {
+		char buf[4], *r = buf;
+		const char *at = p->s++;
+		if (!decode_escape(&r, p))
+			return fail(p, KJSON_ERR_ESCAPE, at);
+		*esc = true;
+	}
+	if (*p->s != '"')
+		return fail(p, KJSON_ERR_CONTROL, p->s);
+	p->s++;
+	return true;
+}
+
+bool kjson_read_string_raw(struct kjson_parser *p, struct kjson_string *s,
+                           bool *escaped)
+{
+	char *begin = p->s + 1;
+	if (!skip_string(p, escaped))
+		return false;
+	s->begin = begin;
+	s->len = p->s - 1 - begin;
+	return true;
+}
+
+bool kjson_string_decode(const struct kjson_string *s, char *out, size_t *len)
+{
+	char *r = out;
+	struct kjson_parser p = { .s = s->begin };
+	for (const char *end = s->begin + s->len; p.s < end;) {
+		const char *esc = memchr(p.s, '\\', end - p.s);
+		size_t n = (esc ? esc : end) - p.s;
+		memmove(r, p.s, n);
+		r += n;
+		p.s += n;
+		if (esc && (p.s++, !decode_escape(&r, &p)))
+			return false;
+	}
+	*r = '\0';
+	if (len)
+		*len = r - out;
+	return true;
+}
+
+/* Reads the string at p->s into *s, decoding it in place unless p->flags
+ * contains KJSON_PARSE_RAW_STRINGS. Sets *esc if *s is left with escape
+ * sequences. */
+static bool read_string(struct kjson_parser *p, struct kjson_string *s,
+                        bool *esc)
+{
+	if (p->flags & KJSON_PARSE_RAW_STRINGS)
+		return kjson_read_string_raw(p, s, esc);
+	*esc = false;
+	return kjson_read_string_utf8(p, &s->begin, &s->len);
+}
+
+/* Values of the base64 alphabet (RFC 4648, sec. 4) plus 1, 0 means invalid. */
+#define B64(c,v)	[c] = (v) + 1
+static const unsigned char b64_dec[256] = {
+	B64('A', 0), B64('B', 1), B64('C', 2), B64('D', 3), B64('E', 4), B64('F', 5),
+	B64('G', 6), B64('H', 7), B64('I', 8), B64('J', 9), B64('K',10), B64('L',11),
+	B64('M',12), B64('N',13), B64('O',14), B64('P',15), B64('Q',16), B64('R',17),
+	B64('S',18), B64('T',19), B64('U',20), B64('V',21), B64('W',22), B64('X',23),
+	B64('Y',24), B64('Z',25), B64('a',26), B64('b',27), B64('c',28), B64('d',29),
+	B64('e',30), B64('f',31), B64('g',32), B64('h',33), B64('i',34), B64('j',35),
+	B64('k',36), B64('l',37), B64('m',38), B64('n',39), B64('o',40), B64('p',41),
+	B64('q',42), B64('r',43), B64('s',44), B64('t',45), B64('u',46), B64('v',47),
+	B64('w',48), B64('x',49), B64('y',50), B64('z',51), B64('0',52), B64('1',53),
+	B64('2',54), B64('3',55), B64('4',56), B64('5',57), B64('6',58), B64('7',59),
+	B64('8',60), B64('9',61), B64('+',62), B64('/',63),
+};
+#undef B64
+
+bool kjson_base64_decode(char *dst, const char *src, size_t n, size_t *len)
+{
+	/* padding is optional, but if present it completes the last group of 4
+	 * characters */
+	if (n % 4 == 0 && n && src[n-1] == '=')
+		n -= src[n-2] == '=' ? 2 : 1;
+	const char *end = src + n;
+	char *d = dst;
+	/* 4 characters -> 3 bytes; since d never overtakes src, this also works
+	 * in place */
+	for (; end - src >= 4; src += 4, d += 3) {
+		uint_least32_t a = b64_dec[(unsigned char)src[0]];
+		uint_least32_t b = b64_dec[(unsigned char)src[1]];
+		uint_least32_t c = b64_dec[(unsigned char)src[2]];
+		uint_least32_t e = b64_dec[(unsigned char)src[3]];
+		if (!a || !b || !c || !e)
+			return false;
+		uint_least32_t x = (a-1) << 18 | (b-1) << 12 | (c-1) << 6 | (e-1);
+		d[0] = x >> 16;
+		d[1] = x >> 8;
+		d[2] = x;
+	}
+	if (end - src == 1)
+		return false;
+	if (end - src >= 2) {
+		uint_least32_t a = b64_dec[(unsigned char)src[0]];
+		uint_least32_t b = b64_dec[(unsigned char)src[1]];
+		uint_least32_t c = end - src == 3 ? b64_dec[(unsigned char)src[2]] : 1;
+		if (!a || !b || !c)
+			return false;
+		uint_least32_t x = (a-1) << 18 | (b-1) << 12 | (c-1) << 6;
+		/* the bits not making up a byte have to be zero */
+		if (x & (end - src == 3 ? 0xc0 : 0xff00))
+			return false;
+		*d++ = x >> 16;
+		if (end - src == 3)
+			*d++ = x >> 8;
+	}
+	if (len)
+		*len = d - dst;
+	return true;
+}
+
+bool kjson_read_string_base64(struct kjson_parser *p, char **begin, size_t *len)
+{
+	char *s;
+	size_t n;
+	if (*p->s == '"' && *(s = str_special(p->s + 1)) == '"') {
+		/* no escapes: just find the end of the string */
+		*begin = p->s + 1;
+		n = s - *begin;
+		p->s = s + 1;
+	} else if (!kjson_read_string_utf8(p, begin, &n))
+		return false;
+	return kjson_base64_decode(*begin, *begin, n, len);
+}
+
 /* --------------------------------------------------------------------------
  * mid-level interface
  * -------------------------------------------------------------------------- */
 
 static void skip_space(struct kjson_parser *p)
 {
+	/* compact JSON mostly has no whitespace between tokens */
+	if ((unsigned char)*p->s > ' ')
+		return;
 	p->s += strspn(p->s, "\t\r\n ");
 }
 
+void kjson_skip_space(struct kjson_parser *p)
+{
+	skip_space(p);
+}
+
 int kjson_read_number(struct kjson_parser *p, union kjson_leaf_raw *leaf)
 {
 	leaf->n.integer = p->s;
@@ -245,20 +530,464 @@ int kjson_read_number(struct kjson_parser *p, union kjson_leaf_raw *leaf)
 	return KJSON_LEAF_NUMBER;
 }
 
+/* Advances p->s past the null, boolean, number or string at p->s. */
+static bool skip_leaf(struct kjson_parser *p)
+{
+	bool b;
+	union kjson_leaf_raw l;
+	const char *s = p->s;
+	switch (*p->s) {
+	case '"': return skip_string(p, &b);
+	case 'n': return kjson_read_null(p) || fail(p, KJSON_ERR_VALUE, s);
+	case 't':
+	case 'f': return kjson_read_bool(p, &b) || fail(p, KJSON_ERR_VALUE, s);
+	default :
+		if (kjson_read_number(p, &l) >= 0)
+			return true;
+		return fail(p, p->s == s ? KJSON_ERR_VALUE : KJSON_ERR_NUMBER, p->s);
+	}
+}
+
+bool kjson_skip(struct kjson_parser *p)
+{
+	/* Same approach as kjson_parse_mid2(): in order to not need a stack,
+	 * strings followed by ':' are keys, all other tokens are values. */
+	size_t depth = 0;
+	for (bool have_str = false;;) {
+		bool b;
+		if (have_str) {
+			/* string array entry skipped while looking for a key */
+			have_str = false;
+		} else if (*p->s == '[' || *p->s == '{') {
+			/* in ASCII, '['+2 == ']' and '{'+2 == '}' */
+			char close = *p->s + 2;
+			p->s++;
+			skip_space(p);
+			if (*p->s != close) {
+				depth++;
+				goto entry;
+			}
+			p->s++;
+		} else if (!skip_leaf(p))
+			return false;
+
+		while (depth && (skip_space(p), *p->s != ',')) {
+			if (*p->s != ']' && *p->s != '}')
+				return fail(p, KJSON_ERR_COMMA, p->s);
+			p->s++;
+			depth--;
+		}
+		if (!depth)
+			return true;
+		p->s++; /* skip ',' */
+		skip_space(p);
+entry:
+		if (*p->s == '"') {
+			if (!skip_string(p, &b))
+				return false;
+			skip_space(p);
+			if (*p->s == ':') {
+				p->s++;
+				skip_space(p);
+			} else
+				have_str = true;
+		}
+	}
+}
+
+bool kjson_count_elements(struct kjson_parser *p, size_t *n)
+{
+	if (*p->s != '[' && *p->s != '{')
+		return fail(p, KJSON_ERR_VALUE, p->s);
+	/* in ASCII, '['+2 == ']' and '{'+2 == '}' */
+	char close = *p->s++ + 2;
+	skip_space(p);
+	if (*p->s == close) {
+		p->s++;
+		*n = 0;
+		return true;
+	}
+	if (*p->s == ',')
+		return fail(p, KJSON_ERR_VALUE, p->s);
+	size_t depth = 1, commas = 0;
+	for (;;) {
+		switch (*p->s++) {
+		case '"':
+			while (*(p->s = str_special(p->s)) != '"') {
+				/* skip escaped character, fail on control ones */
+				if (!*p->s || (*p->s == '\\' && !p->s[1]))
+					return fail(p, KJSON_ERR_EOF, p->s);
+				if (*p->s != '\\')
+					return fail(p, KJSON_ERR_CONTROL, p->s);
+				p->s += 2;
+			}
+			p->s++;
+			break;
+		case '[':
+		case '{':
+			depth++;
+			skip_space(p);
+			if (*p->s == ',')
+				return fail(p, KJSON_ERR_VALUE, p->s);
+			break;
+		case ']':
+		case '}':
+			if (!--depth) {
+				if (p->s[-1] != close)
+					return fail(p, KJSON_ERR_COMMA, p->s - 1);
+				*n = commas + 1;
+				return true;
+			}
+			break;
+		case ',':
+			commas += depth == 1;
+			skip_space(p);
+			if (*p->s == ',' || *p->s == ']' || *p->s == '}')
+				return fail(p, KJSON_ERR_VALUE, p->s);
+			break;
+		case '\0':
+			p->s--;
+			return fail(p, KJSON_ERR_EOF, p->s);
+		}
+	}
+}
+
+/* Returns a pointer to the first '"', '\\', ASCII control character or, if
+ * ascii, non-ASCII byte in s[0..end-s-1], or end if there is none. Unlike
+ * str_special(), only bytes before end are read. */
+static const char * str_special_n(const char *s, const char *end, bool ascii)
+{
+#ifdef UL_REPEATED8
+	unsigned long ones = UL_REPEATED8(0x01), high_bits = ones << 7;
+	unsigned long non_ascii = ascii ? high_bits : 0;
+	for (; (size_t)(end - s) >= sizeof(unsigned long);
+	     s += sizeof(unsigned long)) {
+		unsigned long x;
+		memcpy(&x, s, sizeof(x));
+		unsigned long a = x ^ UL_REPEATED8('"');
+		unsigned long b = x ^ UL_REPEATED8('\\');
+		unsigned long d = x & ~UL_REPEATED8(0x1f);
+		if ((((a - ones) & ~a) | ((b - ones) & ~b) | ((d - ones) & ~d) |
+		     (x & non_ascii)) & high_bits)
+			break;
+	}
+#endif
+	for (; s < end; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\' || c <= 0x1f || (ascii && c >= 0x80))
+			break;
+	}
+	return s;
+}
+
+static bool is_hex(char c)
+{
+	return ('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'f');
+}
+
+/* Returns the position after the \u escape at s[0..5] if it is a high
+ * surrogate followed by a low one or not a surrogate at all, else NULL. */
+static const char * validate_uescape(const char *s, const char *end)
+{
+	unsigned u, lo;
+	if (end - s < 6 || !is_hex(s[2]) || !is_hex(s[3]) || !is_hex(s[4]) ||
+	    !is_hex(s[5]))
+		return NULL;
+	hex4(&u, s+2);
+	s += 6;
+	if (u < 0xd800 || u >= 0xe000)
+		return s;
+	if (u >= 0xdc00 || end - s < 6 || s[0] != '\\' || s[1] != 'u' ||
+	    !is_hex(s[2]) || !is_hex(s[3]) || !is_hex(s[4]) || !is_hex(s[5]))
+		return NULL;
+	hex4(&lo, s+2);
+	return 0xdc00 <= lo && lo < 0xe000 ? s + 6 : NULL;
+}
+
+/* Returns the position after the UTF-8 (RFC 3629) sequence starting with the
+ * non-ASCII byte at s or NULL if it is invalid. */
+static const char * validate_utf8_seq(const char *s, const char *end)
+{
+	const unsigned char *u = (const unsigned char *)s;
+	size_t n, avail = end - s;
+	unsigned char lo = 0x80, hi = 0xbf;
+	if (u[0] < 0xc2)
+		return NULL; /* continuation byte or overlong */
+	else if (u[0] < 0xe0)
+		n = 2;
+	else if (u[0] < 0xf0) {
+		n = 3;
+		if (u[0] == 0xe0)
+			lo = 0xa0; /* overlong */
+		else if (u[0] == 0xed)
+			hi = 0x9f; /* surrogate */
+	} else if (u[0] < 0xf5) {
+		n = 4;
+		if (u[0] == 0xf0)
+			lo = 0x90; /* overlong */
+		else if (u[0] == 0xf4)
+			hi = 0x8f; /* > U+10FFFF */
+	} else
+		return NULL;
+	if (avail < n || u[1] < lo || u[1] > hi)
+		return NULL;
+	for (size_t i=2; i<n; i++)
+		if ((u[i] & 0xc0) != 0x80)
+			return NULL;
+	return s + n;
+}
+
+/* Stores kind in *err and the position at in *s and returns false. */
+static COLD bool validate_fail(const char **s, const char *at,
+                               enum kjson_error *err, enum kjson_error kind)
+{
+	*err = kind;
+	*s = at;
+	return false;
+}
+
+/* Checks the string starting after the '"' at *s and advances *s past its
+ * closing '"'. On failure, *s is set to the offending byte and its kind is
+ * stored in *err; the same holds for the other validate_*() functions. */
+static bool validate_string(const char **s, const char *end, bool utf8,
+                            enum kjson_error *err)
+{
+	const char *t = *s, *u;
+	for (;;) {
+		t = str_special_n(t, end, utf8);
+		if (t == end)
+			return validate_fail(s, t, err, KJSON_ERR_EOF);
+		if (*t == '"')
+			break;
+		if (*t == '\\') {
+			if (end - t < 2)
+				return validate_fail(s, end, err, KJSON_ERR_EOF);
+			if (t[1] == 'u') {
+				if (!(u = validate_uescape(t, end)))
+					return validate_fail(s, t, err,
+					                     KJSON_ERR_ESCAPE);
+				t = u;
+			} else if (t[1] && strchr("\"\\/bfnrt", t[1])) {
+				t += 2;
+			} else
+				return validate_fail(s, t, err, KJSON_ERR_ESCAPE);
+		} else if ((unsigned char)*t <= 0x1f) {
+			return validate_fail(s, t, err, KJSON_ERR_CONTROL);
+		} else if (!(u = validate_utf8_seq(t, end)))
+			return validate_fail(s, t, err, KJSON_ERR_UTF8);
+		else
+			t = u;
+	}
+	*s = t + 1;
+	return true;
+}
+
+static bool validate_digits(const char **s, const char *end)
+{
+	const char *t = *s;
+	while (t < end && '0' <= *t && *t <= '9')
+		t++;
+	if (t == *s)
+		return false;
+	*s = t;
+	return true;
+}
+
+static bool validate_number(const char **s, const char *end,
+                            enum kjson_error *err)
+{
+	const char *t = *s;
+	if (t < end && *t == '-')
+		t++;
+	if (t < end && *t == '0')
+		t++;
+	else if (!(t < end && '1' <= *t && *t <= '9') ||
+	         !validate_digits(&t, end))
+		return validate_fail(s, t, err, t == *s ? KJSON_ERR_VALUE
+		                                        : KJSON_ERR_NUMBER);
+	if (t < end && *t == '.') {
+		t++;
+		if (!validate_digits(&t, end))
+			return validate_fail(s, t, err, KJSON_ERR_NUMBER);
+	}
+	if (t < end && (*t == 'e' || *t == 'E')) {
+		t++;
+		if (t < end && (*t == '+' || *t == '-'))
+			t++;
+		if (!validate_digits(&t, end))
+			return validate_fail(s, t, err, KJSON_ERR_NUMBER);
+	}
+	*s = t;
+	return true;
+}
+
+static const char * validate_space(const char *s, const char *end)
+{
+	if (s < end && (unsigned char)*s > ' ')
+		return s;
+	while (s < end && (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t'))
+		s++;
+	return s;
+}
+
+/* Checks for a key and the following ':' at *s. */
+static bool validate_key(const char **s, const char *end, bool utf8,
+                         enum kjson_error *err)
+{
+	const char *t = *s;
+	if (t == end || *t != '"')
+		return validate_fail(s, t, err, KJSON_ERR_STRING);
+	*s = t + 1;
+	if (!validate_string(s, end, utf8, err))
+		return false;
+	t = validate_space(*s, end);
+	if (t == end || *t != ':')
+		return validate_fail(s, t, err, KJSON_ERR_COLON);
+	*s = validate_space(t + 1, end);
+	return true;
+}
+
+#define VALIDATE_WORD_BITS	(sizeof(unsigned long) * CHAR_BIT)
+
+static bool validate(const char *s, size_t len, bool utf8,
+                     enum kjson_error *err, const char **at)
+{
+	/* Bit i of the stack is set if the composite at depth i is an object. */
+	unsigned long stack[(KJSON_VALIDATE_MAX_DEPTH + VALIDATE_WORD_BITS - 1)
+	                    / VALIDATE_WORD_BITS];
+	size_t depth = 0;
+	const char *end = s + len;
+	enum kjson_error e = KJSON_ERR_NONE;
+	s = validate_space(s, end);
+	for (;;) {
+		if (s == end)
+			goto fail;
+		/* value */
+		switch (*s) {
+		case '{':
+		case '[': {
+			bool obj = *s == '{';
+			/* in ASCII, '['+2 == ']' and '{'+2 == '}' */
+			char close = *s + 2;
+			const char *open = s;
+			s = validate_space(s + 1, end);
+			if (s < end && *s == close) {
+				s++;
+				break;
+			}
+			if (depth == KJSON_VALIDATE_MAX_DEPTH) {
+				e = KJSON_ERR_DEPTH;
+				s = open;
+				goto fail;
+			}
+			unsigned long bit = 1UL << depth % VALIDATE_WORD_BITS;
+			unsigned long *w = &stack[depth / VALIDATE_WORD_BITS];
+			*w = obj ? *w | bit : *w & ~bit;
+			depth++;
+			if (obj && !validate_key(&s, end, utf8, &e))
+				goto fail;
+			continue;
+		}
+		case '"':
+			s++;
+			if (!validate_string(&s, end, utf8, &e))
+				goto fail;
+			break;
+		case 'n':
+		case 't':
+		case 'f': {
+			const char *lit = *s == 'n' ? "null"
+			                : *s == 't' ? "true" : "false";
+			size_t n = strlen(lit);
+			if ((size_t)(end - s) < n || memcmp(s, lit, n)) {
+				e = KJSON_ERR_VALUE;
+				goto fail;
+			}
+			s += n;
+			break;
+		}
+		default:
+			if (!validate_number(&s, end, &e))
+				goto fail;
+			break;
+		}
+		/* after a value: ',' or closing brackets */
+		for (;;) {
+			s = validate_space(s, end);
+			if (!depth) {
+				if (s == end)
+					return true;
+				e = KJSON_ERR_TRAILING;
+				goto fail;
+			}
+			if (s == end)
+				goto fail;
+			bool obj = stack[(depth-1) / VALIDATE_WORD_BITS] >>
+			           (depth-1) % VALIDATE_WORD_BITS & 1;
+			if (*s == ',') {
+				s = validate_space(s + 1, end);
+				if (obj && !validate_key(&s, end, utf8, &e))
+					goto fail;
+				break;
+			}
+			if (*s != (obj ? '}' : ']')) {
+				e = KJSON_ERR_COMMA;
+				goto fail;
+			}
+			s++;
+			depth--;
+		}
+	}
+fail:
+	*err = s == end ? KJSON_ERR_EOF : e;
+	*at = s;
+	return false;
+}
+
+bool kjson_validate(const char *buf, size_t len)
+{
+	enum kjson_error err;
+	const char *at;
+	return validate(buf, len, false, &err, &at);
+}
+
+bool kjson_validate_utf8(const char *buf, size_t len)
+{
+	enum kjson_error err;
+	const char *at;
+	return validate(buf, len, true, &err, &at);
+}
+
+bool kjson_validate_err(const char *buf, size_t len, bool utf8,
+                        enum kjson_error *err, size_t *off)
+{
+	const char *at;
+	if (validate(buf, len, utf8, err, &at))
+		return true;
+	*off = at - buf;
+	return false;
+}
+
 static int kjson_parse_leaf(struct kjson_parser *p, union kjson_leaf_raw *leaf,
                             const struct kjson_mid_cb *cb)
 {
 	if (*p->s == '"') {
-		if (!kjson_read_string_utf8(p, &leaf->s.begin, &leaf->s.len))
+		bool esc;
+		if (!read_string(p, &leaf->s, &esc))
 			return -1;
-		return KJSON_LEAF_STRING;
+		return esc ? KJSON_LEAF_STRING_ESCAPED : KJSON_LEAF_STRING;
 	} else if (kjson_read_null(p)) {
 		return KJSON_LEAF_NULL;
 	} else if (kjson_read_bool(p, &leaf->b)) {
 		return KJSON_LEAF_BOOLEAN;
 	} else {
-		return cb->read_other ? cb->read_other(cb, p, leaf)
-		                      : kjson_read_number(p, leaf);
+		const char *s = p->s;
+		int r = cb->read_other ? cb->read_other(cb, p, leaf)
+		                       : kjson_read_number(p, leaf);
+		if (r < 0)
+			fail(p, p->s == s ? KJSON_ERR_VALUE : KJSON_ERR_NUMBER,
+			     p->s);
+		return r;
 	}
 }
 
@@ -280,7 +1009,7 @@ bool kjson_parse_mid_rec(struct kjson_parser *p, const struct kjson_mid_cb *c)
 				skip_space(p);
 			}
 		if (*p->s != ']')
-			return false;
+			return fail(p, KJSON_ERR_COMMA, p->s);
 		p->s++; /* skip ']' */
 		c->end(c, true);
 	} else if (*p->s == '{') {
@@ -290,12 +1019,12 @@ bool kjson_parse_mid_rec(struct kjson_parser *p, const struct kjson_mid_cb *c)
 		if (*p->s != '}')
 			while (1) {
 				struct kjson_string key;
-				if (!kjson_read_string_utf8(p, &key.begin,
-				                            &key.len))
+				bool esc;
+				if (!read_string(p, &key, &esc))
 					return false;
 				skip_space(p);
 				if (*p->s != ':')
-					return false;
+					return fail(p, KJSON_ERR_COLON, p->s);
 				p->s++; /* skip ':' */
 				c->o_entry(c, &key);
 				skip_space(p);
@@ -308,7 +1037,7 @@ bool kjson_parse_mid_rec(struct kjson_parser *p, const struct kjson_mid_cb *c)
 				skip_space(p);
 			}
 		if (*p->s != '}')
-			return false;
+			return fail(p, KJSON_ERR_COMMA, p->s);
 		p->s++; /* skip '}' */
 		c->end(c, false);
 	} else {
@@ -327,8 +1056,8 @@ bool kjson_parse_mid(struct kjson_parser *p, const struct kjson_mid_cb *c)
 	return kjson_parse_mid2(p, c, &leaf);
 }
 
-bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
-                      union kjson_leaf_raw *leaf)
+static bool parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
+                       union kjson_leaf_raw *leaf)
 {
 	/* In the stack-based parser kjson_parse_mid_rec() above, the only
 	 * information stored for each level of parse tree is whether it is
@@ -347,6 +1076,9 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 	unsigned depth = 0;
 	                             /* next string token, only valid if ... */
 	bool leaf_have_str = false;  /* ... leaf_have_str is true (in arrays) */
+	bool leaf_esc = false;       /* whether it contains escapes */
+	/* Whether the value read next is that of an object entry. */
+	bool in_obj = false;
 	while (1) {
 		char fst = *p->s;
 
@@ -357,11 +1089,16 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 		 * and don't need to decide that again at the end of the
 		 * loop. */
 		bool known_in_arr = leaf_have_str; /* optimization for arrays */
+		/* Likewise, if the value read in this iteration is no
+		 * composite with entries, its successor is in the same
+		 * composite. Only used to classify syntax errors. */
+		bool known_in_obj = in_obj;
 
 		if (leaf_have_str) {
 			/* The previous iteration left a string token in
 			 * 'leaf'. */
-			c->leaf(c, KJSON_LEAF_STRING, leaf);
+			c->leaf(c, leaf_esc ? KJSON_LEAF_STRING_ESCAPED
+			                    : KJSON_LEAF_STRING, leaf);
 			leaf_have_str = false;
 		} else if (fst == '[' || fst == '{') {
 			/* Begin a new composite token; empty composites are
@@ -380,6 +1117,7 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 				depth++;
 				ao_fst = true;
 				known_in_arr = this_is_arr;
+				known_in_obj = !this_is_arr;
 			}
 		} else {
 			/* Leaf token. */
@@ -397,11 +1135,12 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 				switch (*p->s) {
 				case ']': c->end(c, true); break;
 				case '}': c->end(c, false); break;
-				default: return false;
+				default: return fail(p, KJSON_ERR_COMMA, p->s);
 				}
 				p->s++;
 				depth--;
 				known_in_arr = false;
+				known_in_obj = false;
 			}
 
 		/* Token read (and back) on top-level, this is the end. */
@@ -413,19 +1152,20 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 		 * element of the composite follows. */
 		if (!ao_fst) {
 			if (*p->s != ',')
-				return false;
+				return fail(p, KJSON_ERR_COMMA, p->s);
 			p->s++;
 			skip_space(p);
 		}
 
 		/* If we already determined that we are in an array *or* the
-		 * next token is not a string, it must be an array. */
-		if (known_in_arr || *p->s != '"')
+		 * next token is not a string, it must be an array, unless we
+		 * know to be in an object: then read_string() fails. */
+		in_obj = false;
+		if (known_in_arr || (*p->s != '"' && !known_in_obj))
 			c->a_entry(c);
 		else {
 			/* maybe object */
-			if (!kjson_read_string_utf8(p, &leaf->s.begin,
-			                               &leaf->s.len))
+			if (!read_string(p, &leaf->s, &leaf_esc))
 				return false;
 			skip_space(p);
 			if (*p->s == ':') {
@@ -433,6 +1173,9 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 				c->o_entry(c, &leaf->s);
 				p->s++; /* skip ':' */
 				skip_space(p);
+				in_obj = true;
+			} else if (known_in_obj) {
+				return fail(p, KJSON_ERR_COLON, p->s);
 			} else {
 				/* in array, keep 'leaf' for the next
 				 * iteration */
@@ -443,6 +1186,45 @@ bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
 	}
 }
 
+bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
+                      union kjson_leaf_raw *leaf)
+{
+	PROBE(parse_mid_start, p->s);
+	bool r = parse_mid2(p, c, leaf);
+	PROBE(parse_mid_end, p->s, r);
+	return r;
+}
+
+char * kjson_skip_separators(char *s, const char *end)
+{
+	while (s < end && (*s == ' ' || *s == '\n' || *s == '\r' ||
+	                   *s == '\t' || *s == '\x1e'))
+		s++;
+	return s;
+}
+
+bool kjson_parse_many(char *buf, size_t len, const struct kjson_many_cb *c,
+                      unsigned flags, size_t *n)
+{
+	/* each document ends where the parser stopped, no need to delimit
+	 * them beforehand */
+	char *end = buf + len;
+	size_t i = 0;
+	PROBE(parse_many_start, buf, len);
+	for (char *s; (s = kjson_skip_separators(buf, end)) < end; i++) {
+		struct kjson_parser p = { .s = s, .flags = flags };
+		if (!c->doc(c, &p, i) || p.s == s || p.s > end) {
+			PROBE(parse_many_end, i, false);
+			*n = i;
+			return false;
+		}
+		buf = p.s;
+	}
+	PROBE(parse_many_end, i, true);
+	*n = i;
+	return true;
+}
+
 /* --------------------------------------------------------------------------
  * high-level interface
  * -------------------------------------------------------------------------- */
@@ -460,6 +1242,7 @@ struct high_cb {
 	size_t stack_sz;
 	size_t stack_cap;
 	kjson_store_leaf_f *store_leaf;
+	bool raw_keys;
 };
 
 #define ELEM_INIT { .arr = { .data = NULL, .n = 0 }, .cap = 0 }
@@ -487,7 +1270,8 @@ static void high_leaf(const struct kjson_mid_cb *c, enum kjson_leaf_type type,
 		v->n = l->n;
 		break;
 	case KJSON_LEAF_STRING:
-		v->type = KJSON_VALUE_STRING;
+	case KJSON_LEAF_STRING_ESCAPED:
+		v->type = (enum kjson_value_type)type;
 		v->s = l->s;
 		break;
 	default:
@@ -501,6 +1285,7 @@ static void ensure_one_left(size_t n, size_t *cap, void **data, size_t elem_sz)
 	if (n == *cap) {
 		*cap = 2*(*cap ? *cap : 1);
 		*data = realloc(*data, *cap * elem_sz);
+		PROBE(grow, *data, *cap * elem_sz);
 	}
 }
 
@@ -546,6 +1331,7 @@ static void high_end(const struct kjson_mid_cb *c, bool in_a)
 		v->type = KJSON_VALUE_ARRAY;
 		v->a = e->arr;
 	} else {
+		e->obj.raw_keys = cb->raw_keys;
 		v->type = KJSON_VALUE_OBJECT;
 		v->o = e->obj;
 	}
@@ -573,100 +1359,1271 @@ bool kjson_parse2(struct kjson_parser *p, struct kjson_value *v,
 		.stack_sz   = 1,
 		.stack_cap  = 1,
 		.store_leaf = store_leaf,
+		.raw_keys   = p->flags & KJSON_PARSE_RAW_STRINGS,
 	};
 	cb.stack[0] = (struct elem){ .v = v, };
+	PROBE(parse_start, p->s);
 	bool r = kjson_parse_mid(p, &cb.parent);
+	PROBE(parse_end, p->s, r);
 	assert(!r || cb.stack_sz == 1);
 	free(cb.stack);
 	return r;
 }
 
-static void kjson_value_print_composite(FILE *f, const struct kjson_value *v,
-                                        int depth)
+/* Computes the number of bytes needed for the children of *v (*nodes) and for
+ * the strings and numbers (*bytes) in a compact copy of *v. */
+static void compact_size(const struct kjson_value *v, size_t *nodes,
+                         size_t *bytes)
 {
 	switch (v->type) {
 	case KJSON_VALUE_NULL:
-		fprintf(f, "null");
-		break;
 	case KJSON_VALUE_BOOLEAN:
-		fprintf(f, "%s", v->b ? "true" : "false");
 		break;
 	case KJSON_VALUE_NUMBER:
-		fprintf(f, "%.*s", (int)(v->n.end - v->n.integer),
-		        v->n.integer);
+		*bytes += v->n.end - v->n.integer + 1;
 		break;
 	case KJSON_VALUE_STRING:
-		fputc('"', f);
-		for (size_t i=0; i<v->s.len; i++) {
-			char c = v->s.begin[i];
-			if (c == '"' || c == '\\')
-				fprintf(f, "\\%c", c);
-			else if ((unsigned char)c <= 0x1f)
-				fprintf(f, "\\u%04x", c);
-			else
-				fputc(c, f);
-		}
-		fputc('"', f);
-		break;
-	case KJSON_VALUE_OBJECT:
-		if (!v->o.n) {
-			fprintf(f, "{}");
-		} else {
-			fprintf(f, "{\n%*s", 4*(depth+1), "");
-			for (size_t i=0; i<v->o.n; i++) {
-				fprintf(f, "\"%.*s\": ",
-				        (int)v->o.data[i].key.len,
-				        v->o.data[i].key.begin);
-				kjson_value_print_composite(f,
-				                            &v->o.data[i].value,
-				                            depth+1);
-				if (i+1 < v->o.n)
-					fprintf(f, ",\n%*s", 4*(depth+1), "");
-			}
-			fprintf(f, "\n%*s}", 4*depth, "");
-		}
+	case KJSON_VALUE_STRING_ESCAPED:
+		*bytes += v->s.len + 1;
 		break;
 	case KJSON_VALUE_ARRAY:
-		if (!v->a.n) {
-			fprintf(f, "[]");
-		} else {
-			fprintf(f, "[");
-			for (size_t i=0; i<v->o.n; i++) {
-				kjson_value_print_composite(f, &v->a.data[i],
-				                            depth+1);
-				if (i+1 < v->o.n)
-					fprintf(f, ", ");
-			}
-			fprintf(f, "]");
+		*nodes += v->a.n * sizeof(*v->a.data);
+		for (size_t i=0; i<v->a.n; i++)
+			compact_size(&v->a.data[i], nodes, bytes);
+		break;
+	case KJSON_VALUE_OBJECT:
+		*nodes += v->o.n * sizeof(*v->o.data);
+		for (size_t i=0; i<v->o.n; i++) {
+			*bytes += v->o.data[i].key.len + 1;
+			compact_size(&v->o.data[i].value, nodes, bytes);
 		}
 		break;
-	default: return;
+	default: break;
 	}
 }
 
-void kjson_value_print(FILE *f, const struct kjson_value *v)
+struct compact {
+	char *nodes;
+	char *bytes;
+};
+
+static char * compact_bytes(struct compact *c, const char *s, size_t n)
 {
-	kjson_value_print_composite(f, v, 0);
+	char *r = c->bytes;
+	memcpy(r, s, n);
+	r[n] = '\0';
+	c->bytes += n + 1;
+	return r;
 }
 
-void kjson_value_fini(const struct kjson_value *v)
+static void compact_copy(struct compact *c, struct kjson_value *w,
+                         const struct kjson_value *v)
 {
+	*w = *v;
 	switch (v->type) {
 	case KJSON_VALUE_NULL:
 	case KJSON_VALUE_BOOLEAN:
+		break;
 	case KJSON_VALUE_NUMBER:
+		w->n.integer = compact_bytes(c, v->n.integer,
+		                             v->n.end - v->n.integer);
+		w->n.fractional = w->n.integer + (v->n.fractional - v->n.integer);
+		w->n.exponent   = w->n.integer + (v->n.exponent - v->n.integer);
+		w->n.end        = w->n.integer + (v->n.end - v->n.integer);
+		break;
 	case KJSON_VALUE_STRING:
-		return;
+	case KJSON_VALUE_STRING_ESCAPED:
+		w->s.begin = compact_bytes(c, v->s.begin, v->s.len);
+		break;
 	case KJSON_VALUE_ARRAY:
+		w->a.data = (struct kjson_value *)c->nodes;
+		c->nodes += v->a.n * sizeof(*v->a.data);
 		for (size_t i=0; i<v->a.n; i++)
-			kjson_value_fini(&v->a.data[i]);
-		free(v->a.data);
-		return;
+			compact_copy(c, &w->a.data[i], &v->a.data[i]);
+		break;
 	case KJSON_VALUE_OBJECT:
-		for (size_t i=0; i<v->o.n; i++)
-			kjson_value_fini(&v->o.data[i].value);
-		free(v->o.data);
+		w->o.data = (struct kjson_object_entry *)c->nodes;
+		c->nodes += v->o.n * sizeof(*v->o.data);
+		for (size_t i=0; i<v->o.n; i++) {
+			struct kjson_object_entry *e = &w->o.data[i];
+			e->key = v->o.data[i].key;
+			e->key.begin = compact_bytes(c, e->key.begin, e->key.len);
+			compact_copy(c, &e->value, &v->o.data[i].value);
+		}
+		break;
+	default: break;
+	}
+}
+
+struct kjson_value * kjson_value_clone_compact(const struct kjson_value *v)
+{
+	size_t nodes = sizeof(*v), bytes = 0;
+	compact_size(v, &nodes, &bytes);
+	struct kjson_value *w = malloc(nodes + bytes);
+	if (!w)
+		return NULL;
+	struct compact c = {
+		.nodes = (char *)(w + 1),
+		.bytes = (char *)w + nodes,
+	};
+	compact_copy(&c, w, v);
+	assert(c.nodes == (char *)w + nodes);
+	assert(c.bytes == (char *)w + nodes + bytes);
+	return w;
+}
+
+const struct kjson_object_entry *
+kjson_object_find(const struct kjson_object *o, const char *key, size_t len)
+{
+	for (size_t i=0; i<o->n; i++)
+		if (o->data[i].key.len == len &&
+		    !memcmp(o->data[i].key.begin, key, len))
+			return &o->data[i];
+	return NULL;
+}
+
+static void kjson_value_print_composite(FILE *f, const struct kjson_value *v,
+                                        int depth);
+
+/* Prints the opening bracket of the array or object *v. */
+static void print_open(FILE *f, const struct kjson_value *v, int depth)
+{
+	if (v->type == KJSON_VALUE_OBJECT) {
+		if (!v->o.n)
+			fprintf(f, "{}");
+		else
+			fprintf(f, "{\n%*s", 4*(depth+1), "");
+	} else
+		fprintf(f, v->a.n ? "[" : "[]");
+}
+
+/* Prints what precedes the value of entry i of the array or object *v. */
+static void print_head(FILE *f, const struct kjson_value *v, size_t i,
+                       int depth)
+{
+	if (v->type == KJSON_VALUE_OBJECT) {
+		if (i)
+			fprintf(f, ",\n%*s", 4*(depth+1), "");
+		fprintf(f, "\"%.*s\": ", (int)v->o.data[i].key.len,
+		        v->o.data[i].key.begin);
+	} else if (i)
+		fprintf(f, ", ");
+}
+
+static void print_entries(FILE *f, const struct kjson_value *v, size_t lo,
+                          size_t hi, int depth)
+{
+	for (size_t i=lo; i<hi; i++) {
+		print_head(f, v, i, depth);
+		kjson_value_print_composite(f, v->type == KJSON_VALUE_OBJECT
+		                               ? &v->o.data[i].value
+		                               : &v->a.data[i], depth+1);
+	}
+}
+
+static void print_close(FILE *f, const struct kjson_value *v, int depth)
+{
+	if (v->type == KJSON_VALUE_OBJECT) {
+		if (v->o.n)
+			fprintf(f, "\n%*s}", 4*depth, "");
+	} else if (v->a.n)
+		fprintf(f, "]");
+}
+
+static void print_string(FILE *f, const char *s, size_t len)
+{
+	fputc('"', f);
+	for (size_t i=0; i<len; i++) {
+		char c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if ((unsigned char)c <= 0x1f)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static void kjson_value_print_composite(FILE *f, const struct kjson_value *v,
+                                        int depth)
+{
+	switch (v->type) {
+	case KJSON_VALUE_NULL:
+		fprintf(f, "null");
+		break;
+	case KJSON_VALUE_BOOLEAN:
+		fprintf(f, "%s", v->b ? "true" : "false");
+		break;
+	case KJSON_VALUE_NUMBER:
+		fprintf(f, "%.*s", (int)(v->n.end - v->n.integer),
+		        v->n.integer);
+		break;
+	case KJSON_VALUE_STRING:
+		print_string(f, v->s.begin, v->s.len);
+		break;
+	case KJSON_VALUE_STRING_ESCAPED:
+		/* raw string, still in JSON syntax */
+		fprintf(f, "\"%.*s\"", (int)v->s.len, v->s.begin);
+		break;
+	case KJSON_VALUE_OBJECT:
+		print_open(f, v, depth);
+		print_entries(f, v, 0, v->o.n, depth);
+		print_close(f, v, depth);
+		break;
+	case KJSON_VALUE_ARRAY:
+		print_open(f, v, depth);
+		print_entries(f, v, 0, v->a.n, depth);
+		print_close(f, v, depth);
+		break;
+	default: return;
+	}
+}
+
+void kjson_value_print(FILE *f, const struct kjson_value *v)
+{
+	kjson_value_print_composite(f, v, 0);
+}
+
+void kjson_value_print_chunk(FILE *f, const struct kjson_print_chunk *c)
+{
+	switch (c->part) {
+	case KJSON_PRINT_VALUE:
+		kjson_value_print_composite(f, c->v, c->depth);
+		break;
+	case KJSON_PRINT_OPEN:
+		print_open(f, c->v, c->depth);
+		break;
+	case KJSON_PRINT_ENTRIES:
+		print_entries(f, c->v, c->lo, c->hi, c->depth);
+		break;
+	case KJSON_PRINT_HEAD:
+		print_head(f, c->v, c->lo, c->depth);
+		break;
+	case KJSON_PRINT_CLOSE:
+		print_close(f, c->v, c->depth);
+		break;
+	}
+}
+
+/* Returns the number of values in *v or limit+1 if that is larger. */
+static size_t count_upto(const struct kjson_value *v, size_t limit)
+{
+	size_t r = 1;
+	if (v->type == KJSON_VALUE_ARRAY)
+		for (size_t i=0; i<v->a.n && r <= limit; i++)
+			r += count_upto(&v->a.data[i], limit - r);
+	else if (v->type == KJSON_VALUE_OBJECT)
+		for (size_t i=0; i<v->o.n && r <= limit; i++)
+			r += count_upto(&v->o.data[i].value, limit - r);
+	return r;
+}
+
+struct print_plan {
+	struct kjson_print_chunk *c;
+	size_t n, cap;
+	size_t grain;
+};
+
+static bool plan_add(struct print_plan *p, enum kjson_print_part part,
+                     const struct kjson_value *v, size_t lo, size_t hi,
+                     int depth)
+{
+	if (p->n == p->cap) {
+		size_t cap = p->cap ? 2 * p->cap : 64;
+		void *c = realloc(p->c, cap * sizeof(*p->c));
+		if (!c)
+			return false;
+		p->c = c;
+		p->cap = cap;
+	}
+	p->c[p->n++] = (struct kjson_print_chunk){ part, v, lo, hi, depth };
+	return true;
+}
+
+static bool plan_value(struct print_plan *p, const struct kjson_value *v,
+                       int depth)
+{
+	if (count_upto(v, p->grain) <= p->grain)
+		return plan_add(p, KJSON_PRINT_VALUE, v, 0, 0, depth);
+	/* v is a big composite: runs of small entries form a chunk each, big
+	 * entries are split recursively */
+	bool obj = v->type == KJSON_VALUE_OBJECT;
+	size_t n = obj ? v->o.n : v->a.n, lo = 0, run = 0;
+	if (!plan_add(p, KJSON_PRINT_OPEN, v, 0, 0, depth))
+		return false;
+	for (size_t i=0; i<n; i++) {
+		const struct kjson_value *w = obj ? &v->o.data[i].value
+		                                  : &v->a.data[i];
+		size_t k = count_upto(w, p->grain);
+		if (k > p->grain) {
+			if ((lo < i && !plan_add(p, KJSON_PRINT_ENTRIES, v, lo, i,
+			                         depth)) ||
+			    !plan_add(p, KJSON_PRINT_HEAD, v, i, i+1, depth) ||
+			    !plan_value(p, w, depth+1))
+				return false;
+			lo = i+1;
+			run = 0;
+		} else if ((run += k) >= p->grain) {
+			if (!plan_add(p, KJSON_PRINT_ENTRIES, v, lo, i+1, depth))
+				return false;
+			lo = i+1;
+			run = 0;
+		}
+	}
+	if (lo < n && !plan_add(p, KJSON_PRINT_ENTRIES, v, lo, n, depth))
+		return false;
+	return plan_add(p, KJSON_PRINT_CLOSE, v, 0, 0, depth);
+}
+
+size_t kjson_value_print_plan(const struct kjson_value *v, size_t grain,
+                              struct kjson_print_chunk **chunks)
+{
+	struct print_plan p = { NULL, 0, 0, grain ? grain : 1 };
+	if (!plan_value(&p, v, 0)) {
+		free(p.c);
+		return 0;
+	}
+	*chunks = p.c;
+	return p.n;
+}
+
+void kjson_value_fini(const struct kjson_value *v)
+{
+	switch (v->type) {
+	case KJSON_VALUE_NULL:
+	case KJSON_VALUE_BOOLEAN:
+	case KJSON_VALUE_NUMBER:
+	case KJSON_VALUE_STRING:
+	case KJSON_VALUE_STRING_ESCAPED:
+		return;
+	case KJSON_VALUE_ARRAY:
+		for (size_t i=0; i<v->a.n; i++)
+			kjson_value_fini(&v->a.data[i]);
+		free(v->a.data);
+		return;
+	case KJSON_VALUE_OBJECT:
+		for (size_t i=0; i<v->o.n; i++)
+			kjson_value_fini(&v->o.data[i].value);
+		free(v->o.data);
 		return;
 	default: return;
 	}
 }
+
+/* --------------------------------------------------------------------------
+ * rewriting interface
+ * -------------------------------------------------------------------------- */
+
+/* Trie of the paths passed to kjson_project(); seg[0..len-1] is the still
+ * escaped reference token. If keep is set, the whole subtree is selected. */
+struct proj_node {
+	const char *seg;
+	size_t len;
+	bool keep;
+	struct proj_node *child, *next;
+};
+
+/* Compares the reference token seg[0..n-1] to the raw key *k. */
+static bool proj_seg_eq(const char *seg, size_t n, const struct kjson_string *k)
+{
+	size_t i = 0, j = 0;
+	for (; i < n && j < k->len; i++, j++) {
+		char c = seg[i];
+		if (c == '~')
+			c = seg[++i] == '1' ? '/' : '~';
+		if (c != k->begin[j])
+			return false;
+	}
+	return i == n && j == k->len;
+}
+
+static const struct proj_node * proj_child(const struct proj_node *t,
+                                           const struct kjson_string *key)
+{
+	for (t = t->child; t; t = t->next)
+		if (proj_seg_eq(t->seg, t->len, key))
+			return t;
+	return NULL;
+}
+
+/* Builds the trie rooted at nodes[0], which has enough space for all segments
+ * of the paths. */
+static bool proj_build(struct proj_node *nodes, const char *const *paths)
+{
+	size_t n = 1;
+	for (; *paths; paths++) {
+		struct proj_node *t = nodes;
+		for (const char *s = *paths; *s; ) {
+			if (*s++ != '/')
+				return false;
+			size_t len = strcspn(s, "/");
+			for (size_t i=0; i<len; i++)
+				if (s[i] == '~' && s[i+1] != '0' && s[i+1] != '1')
+					return false;
+			struct proj_node *c = t->child;
+			while (c && !(c->len == len && !memcmp(c->seg, s, len)))
+				c = c->next;
+			if (!c) {
+				c = &nodes[n++];
+				*c = (struct proj_node){ s, len, false, NULL, t->child };
+				t->child = c;
+			}
+			t = c;
+			s += len;
+		}
+		t->keep = true;
+	}
+	return true;
+}
+
+static void proj_copy(char **w, const char *src, size_t n)
+{
+	memmove(*w, src, n);
+	*w += n;
+}
+
+/* Writes the parts of the value at p->s selected by *t to *w and sets *emitted
+ * accordingly. Since every byte written has been read before, *w never
+ * overtakes p->s. The value is nested 'depth' composites deep; recursion stops
+ * at KJSON_VALIDATE_MAX_DEPTH. */
+static bool proj_value(struct kjson_parser *p, char **w,
+                       const struct proj_node *t, bool *emitted,
+                       unsigned depth)
+{
+	char *begin = p->s;
+	bool first = true;
+	*emitted = true;
+	if (t->keep) {
+		if (!kjson_skip(p))
+			return false;
+		proj_copy(w, begin, p->s - begin);
+	} else if ((*p->s == '{' || *p->s == '[') &&
+	           depth == KJSON_VALIDATE_MAX_DEPTH) {
+		return fail(p, KJSON_ERR_DEPTH, p->s);
+	} else if (*p->s == '{') {
+		p->s++; /* skip '{' */
+		*(*w)++ = '{';
+		skip_space(p);
+		if (*p->s != '}')
+			while (1) {
+				struct kjson_string key;
+				bool esc;
+				char *k = p->s;
+				if (!kjson_read_string_raw(p, &key, &esc))
+					return false;
+				char *k_end = p->s;
+				skip_space(p);
+				if (*p->s != ':')
+					return fail(p, KJSON_ERR_COLON, p->s);
+				p->s++; /* skip ':' */
+				skip_space(p);
+				const struct proj_node *c = proj_child(t, &key);
+				if (!c) {
+					if (!kjson_skip(p))
+						return false;
+				} else {
+					char *mark = *w;
+					bool e;
+					if (!first)
+						*(*w)++ = ',';
+					proj_copy(w, k, k_end - k);
+					*(*w)++ = ':';
+					if (!proj_value(p, w, c, &e, depth+1))
+						return false;
+					if (e)
+						first = false;
+					else
+						*w = mark;
+				}
+				skip_space(p);
+				if (*p->s != ',')
+					break;
+				p->s++; /* skip ',' */
+				skip_space(p);
+			}
+		if (*p->s != '}')
+			return fail(p, KJSON_ERR_COMMA, p->s);
+		p->s++; /* skip '}' */
+		*(*w)++ = '}';
+	} else if (*p->s == '[') {
+		p->s++; /* skip '[' */
+		*(*w)++ = '[';
+		skip_space(p);
+		if (*p->s != ']')
+			while (1) {
+				char *mark = *w;
+				bool e;
+				if (!first)
+					*(*w)++ = ',';
+				if (!proj_value(p, w, t, &e, depth+1))
+					return false;
+				if (e)
+					first = false;
+				else
+					*w = mark;
+				skip_space(p);
+				if (*p->s != ',')
+					break;
+				p->s++; /* skip ',' */
+				skip_space(p);
+			}
+		if (*p->s != ']')
+			return fail(p, KJSON_ERR_COMMA, p->s);
+		p->s++; /* skip ']' */
+		*(*w)++ = ']';
+	} else {
+		*emitted = false;
+		return kjson_skip(p);
+	}
+	return true;
+}
+
+bool kjson_project(struct kjson_parser *p, const char *const *paths, char *out,
+                   size_t *len)
+{
+	size_t n = 1;
+	for (const char *const *q = paths; *q; q++)
+		for (const char *s = *q; *s; s++)
+			n += *s == '/';
+	struct proj_node *nodes = malloc(n * sizeof(*nodes));
+	if (!nodes)
+		return false;
+	*nodes = (struct proj_node){ NULL, 0, false, NULL, NULL };
+	char *w = out;
+	bool e;
+	bool r = proj_build(nodes, paths);
+	if (r) {
+		skip_space(p);
+		r = proj_value(p, &w, nodes, &e, 0);
+	}
+	free(nodes);
+	if (r)
+		*len = w - out;
+	return r;
+}
+
+static bool redact_key(const char *const *keys, const struct kjson_string *k)
+{
+	for (; *keys; keys++)
+		if (!strncmp(*keys, k->begin, k->len) && !(*keys)[k->len])
+			return true;
+	return false;
+}
+
+/* Writes the placeholder for the value v[0..n-1] to w, which may be equal to
+ * v, and returns its length, which is at most n; if pad, exactly n. */
+static size_t redact_value(char *w, const char *v, size_t n, bool pad)
+{
+	bool str = *v == '"';
+	const char *ph = str ? "\"***\"" : n >= 4 ? "null" : "0";
+	size_t k = strlen(ph);
+	if (n < k) {
+		/* short string, keep its length */
+		w[0] = '"';
+		memset(w+1, '*', n-2);
+		w[n-1] = '"';
+		return n;
+	}
+	memcpy(w, ph, k);
+	if (pad) {
+		memset(w+k, ' ', n-k);
+		k = n;
+	}
+	return k;
+}
+
+bool kjson_redact(struct kjson_parser *p, const char *const *keys,
+                  enum kjson_redact_mode mode, size_t *len)
+{
+	/* Same approach as kjson_skip(). In compact mode, the source up to
+	 * 'from' has been moved to w already. */
+	char *begin = p->s, *from = p->s, *w = p->s;
+	size_t depth = 0;
+	for (bool have_val = false;;) {
+		struct kjson_string k;
+		bool esc;
+		if (have_val) {
+			/* string array entry or redacted value */
+			have_val = false;
+		} else if (*p->s == '[' || *p->s == '{') {
+			/* in ASCII, '['+2 == ']' and '{'+2 == '}' */
+			char close = *p->s + 2;
+			p->s++;
+			skip_space(p);
+			if (*p->s != close) {
+				depth++;
+				goto entry;
+			}
+			p->s++;
+		} else if (!skip_leaf(p))
+			return false;
+
+		while (depth && (skip_space(p), *p->s != ',')) {
+			if (*p->s != ']' && *p->s != '}')
+				return fail(p, KJSON_ERR_COMMA, p->s);
+			p->s++;
+			depth--;
+		}
+		if (!depth)
+			break;
+		p->s++; /* skip ',' */
+		skip_space(p);
+entry:
+		if (*p->s == '"') {
+			if (!kjson_read_string_raw(p, &k, &esc))
+				return false;
+			skip_space(p);
+			if (*p->s != ':') {
+				have_val = true;
+				continue;
+			}
+			p->s++;
+			skip_space(p);
+			if (!redact_key(keys, &k))
+				continue;
+			char *v = p->s;
+			if (!kjson_skip(p))
+				return false;
+			if (mode == KJSON_REDACT_MASK) {
+				redact_value(v, v, p->s - v, true);
+			} else {
+				memmove(w, from, v - from);
+				w += v - from;
+				w += redact_value(w, v, p->s - v, false);
+				from = p->s;
+			}
+			have_val = true;
+		}
+	}
+	if (mode != KJSON_REDACT_MASK) {
+		memmove(w, from, p->s - from);
+		w += p->s - from;
+	} else
+		w = p->s;
+	if (len)
+		*len = w - begin;
+	return true;
+}
+
+/* --------------------------------------------------------------------------
+ * schema inference interface
+ * -------------------------------------------------------------------------- */
+
+/* HyperLogLog sketches use 2^SCHEMA_HLL_BITS one-byte registers, which gives a
+ * standard error of about 3%. */
+#define SCHEMA_HLL_BITS		10
+#define SCHEMA_HLL_M		(1u << SCHEMA_HLL_BITS)
+#define SCHEMA_LEN_BINS		24
+#define SCHEMA_MAX_KEYS		256
+
+enum schema_type {
+	SCHEMA_NULL,
+	SCHEMA_BOOLEAN,
+	SCHEMA_INTEGER,
+	SCHEMA_NUMBER,
+	SCHEMA_STRING,
+	SCHEMA_ARRAY,
+	SCHEMA_OBJECT,
+	SCHEMA_N
+};
+
+static const char *const schema_type_names[] = {
+	[SCHEMA_NULL   ] = "null",
+	[SCHEMA_BOOLEAN] = "boolean",
+	[SCHEMA_INTEGER] = "integer",
+	[SCHEMA_NUMBER ] = "number",
+	[SCHEMA_STRING ] = "string",
+	[SCHEMA_ARRAY  ] = "array",
+	[SCHEMA_OBJECT ] = "object",
+};
+
+struct schema_len {
+	size_t min, max, sum;
+	size_t bins[SCHEMA_LEN_BINS];
+};
+
+/* Node of the path trie. Children are kept in the order their keys were first
+ * seen, which usually is the order of the keys in the objects. */
+struct kjson_schema_node {
+	char *key; /* NULL for the root, items and other */
+	size_t key_len;
+	size_t types[SCHEMA_N];
+	struct schema_len str, arr;
+	unsigned char *hll;
+	struct kjson_schema_node **child, *items, *other;
+	size_t n_child, cap_child;
+};
+
+static struct kjson_schema_node * schema_node_new(const char *key, size_t len)
+{
+	struct kjson_schema_node *n = calloc(1, sizeof(*n));
+	if (!n)
+		return NULL;
+	n->str.min = n->arr.min = SIZE_MAX;
+	if (key) {
+		if (!(n->key = malloc(len + 1))) {
+			free(n);
+			return NULL;
+		}
+		memcpy(n->key, key, len);
+		n->key[len] = '\0';
+		n->key_len = len;
+	}
+	return n;
+}
+
+static void schema_node_free(struct kjson_schema_node *n)
+{
+	if (!n)
+		return;
+	for (size_t i=0; i<n->n_child; i++)
+		schema_node_free(n->child[i]);
+	schema_node_free(n->items);
+	schema_node_free(n->other);
+	free(n->child);
+	free(n->hll);
+	free(n->key);
+	free(n);
+}
+
+static bool schema_key_is(const struct kjson_schema_node *n, const char *key,
+                          size_t len)
+{
+	return n->key_len == len && !memcmp(n->key, key, len);
+}
+
+/* Returns the child of n for key[0..len-1], creating it if necessary, or NULL
+ * if memory could not be allocated. *hint is the index to try first, on
+ * return it is set to the index following the child. */
+static struct kjson_schema_node *
+schema_child(struct kjson_schema_node *n, const char *key, size_t len,
+             size_t *hint)
+{
+	size_t i = *hint;
+	if (i >= n->n_child || !schema_key_is(n->child[i], key, len))
+		for (i=0; i<n->n_child; i++)
+			if (schema_key_is(n->child[i], key, len))
+				break;
+	if (i == n->n_child) {
+		if (n->n_child == SCHEMA_MAX_KEYS) {
+			if (!n->other)
+				n->other = schema_node_new(NULL, 0);
+			return n->other;
+		}
+		if (n->n_child == n->cap_child) {
+			size_t cap = n->cap_child ? 2 * n->cap_child : 4;
+			void *c = realloc(n->child, cap * sizeof(*n->child));
+			if (!c)
+				return NULL;
+			n->child = c;
+			n->cap_child = cap;
+		}
+		if (!(n->child[i] = schema_node_new(key, len)))
+			return NULL;
+		n->n_child++;
+	}
+	*hint = i + 1;
+	return n->child[i];
+}
+
+static struct kjson_schema_node * schema_items(struct kjson_schema_node *n)
+{
+	if (!n->items)
+		n->items = schema_node_new(NULL, 0);
+	return n->items;
+}
+
+static void schema_len_add(struct schema_len *l, size_t len)
+{
+	unsigned bin = 0;
+	for (size_t k = len; k && bin < SCHEMA_LEN_BINS-1; k >>= 1)
+		bin++;
+	l->bins[bin]++;
+	l->sum += len;
+	if (len < l->min)
+		l->min = len;
+	if (len > l->max)
+		l->max = len;
+}
+
+static uint64_t schema_hash(const char *s, size_t n)
+{
+	uint64_t h = 0x9e3779b97f4a7c15u ^ n, w;
+	for (; n >= 8; s += 8, n -= 8) {
+		memcpy(&w, s, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdu;
+		h ^= h >> 32;
+	}
+	if (n) {
+		w = 0;
+		for (size_t i=0; i<n; i++)
+			w |= (uint64_t)(unsigned char)s[i] << 8*i;
+		h = (h ^ w) * 0xff51afd7ed558ccdu;
+	}
+	/* MurmurHash3's finalizer */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdu;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53u;
+	h ^= h >> 33;
+	return h;
+}
+
+static bool schema_hll_add(struct kjson_schema_node *n, const char *s,
+                           size_t len)
+{
+	if (!n->hll && !(n->hll = calloc(SCHEMA_HLL_M, 1)))
+		return false;
+	uint64_t h = schema_hash(s, len);
+	uint64_t w = h << SCHEMA_HLL_BITS;
+	unsigned char rank = 1;
+	for (; rank <= 64 - SCHEMA_HLL_BITS && !(w >> 63); w <<= 1)
+		rank++;
+	unsigned char *r = &n->hll[h >> (64 - SCHEMA_HLL_BITS)];
+	if (rank > *r)
+		*r = rank;
+	return true;
+}
+
+/* Natural logarithm of x >= 1, avoiding a dependency on libm. */
+static double schema_ln(double x)
+{
+	int e = 0;
+	for (; x >= 2; x /= 2)
+		e++;
+	/* ln x = 2 artanh((x-1)/(x+1)) for x in [1,2) */
+	double y = (x - 1) / (x + 1), t = y, r = 0;
+	for (unsigned k=1; k<40; k+=2, t *= y * y)
+		r += t / k;
+	return e * 0.69314718055994530942 + 2 * r;
+}
+
+static double schema_hll_estimate(const unsigned char *hll)
+{
+	double m = SCHEMA_HLL_M, sum = 0;
+	unsigned zeros = 0;
+	for (unsigned i=0; i<SCHEMA_HLL_M; i++) {
+		/* ranks are at most 65 - SCHEMA_HLL_BITS */
+		sum += 1.0 / (UINT64_C(1) << hll[i]);
+		zeros += !hll[i];
+	}
+	double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if (e <= 2.5 * m && zeros)
+		e = m * schema_ln(m / zeros); /* linear counting */
+	return e;
+}
+
+struct schema_cb {
+	const struct kjson_mid_cb parent;
+	/* node of the value to be parsed next, NULL if it is not recorded */
+	struct kjson_schema_node *cur;
+	struct schema_frame {
+		struct kjson_schema_node *node;
+		size_t n, hint;
+	} *stack;
+	size_t stack_sz;
+	size_t stack_cap;
+	/* depth of composites not on the stack due to lack of memory */
+	size_t lost;
+	bool oom;
+};
+
+static void schema_leaf(const struct kjson_mid_cb *c, enum kjson_leaf_type type,
+                        union kjson_leaf_raw *l)
+{
+	struct schema_cb *cb = (struct schema_cb *)c;
+	struct kjson_schema_node *n = cb->cur;
+	if (!n)
+		return;
+	switch (type) {
+	case KJSON_LEAF_NULL:
+		n->types[SCHEMA_NULL]++;
+		break;
+	case KJSON_LEAF_BOOLEAN:
+		n->types[SCHEMA_BOOLEAN]++;
+		break;
+	case KJSON_LEAF_NUMBER:
+		if (l->n.fractional == l->n.end)
+			n->types[SCHEMA_INTEGER]++;
+		else
+			n->types[SCHEMA_NUMBER]++;
+		if (!schema_hll_add(n, l->n.integer, l->n.end - l->n.integer))
+			cb->oom = true;
+		break;
+	case KJSON_LEAF_STRING:
+	case KJSON_LEAF_STRING_ESCAPED:
+		n->types[SCHEMA_STRING]++;
+		schema_len_add(&n->str, l->s.len);
+		if (!schema_hll_add(n, l->s.begin, l->s.len))
+			cb->oom = true;
+		break;
+	default:
+		break;
+	}
+}
+
+static void schema_begin(const struct kjson_mid_cb *c, bool in_a)
+{
+	struct schema_cb *cb = (struct schema_cb *)c;
+	if (cb->lost) {
+		cb->lost++;
+		return;
+	}
+	if (cb->stack_sz == cb->stack_cap) {
+		size_t cap = cb->stack_cap ? 2 * cb->stack_cap : 16;
+		void *s = realloc(cb->stack, cap * sizeof(*cb->stack));
+		if (!s) {
+			cb->oom = true;
+			cb->lost++;
+			return;
+		}
+		cb->stack = s;
+		cb->stack_cap = cap;
+	}
+	if (cb->cur)
+		cb->cur->types[in_a ? SCHEMA_ARRAY : SCHEMA_OBJECT]++;
+	cb->stack[cb->stack_sz++] = (struct schema_frame){ .node = cb->cur };
+}
+
+static void schema_a_entry(const struct kjson_mid_cb *c)
+{
+	struct schema_cb *cb = (struct schema_cb *)c;
+	if (cb->lost)
+		return;
+	struct schema_frame *f = &cb->stack[cb->stack_sz-1];
+	f->n++;
+	cb->cur = f->node ? schema_items(f->node) : NULL;
+	if (f->node && !cb->cur)
+		cb->oom = true;
+}
+
+static void schema_o_entry(const struct kjson_mid_cb *c,
+                           struct kjson_string *key)
+{
+	struct schema_cb *cb = (struct schema_cb *)c;
+	if (cb->lost)
+		return;
+	struct schema_frame *f = &cb->stack[cb->stack_sz-1];
+	f->n++;
+	cb->cur = f->node ? schema_child(f->node, key->begin, key->len,
+	                                 &f->hint)
+	                  : NULL;
+	if (f->node && !cb->cur)
+		cb->oom = true;
+}
+
+static void schema_end(const struct kjson_mid_cb *c, bool in_a)
+{
+	struct schema_cb *cb = (struct schema_cb *)c;
+	if (cb->lost) {
+		cb->lost--;
+		return;
+	}
+	struct schema_frame *f = &cb->stack[--cb->stack_sz];
+	if (in_a && f->node)
+		schema_len_add(&f->node->arr, f->n);
+}
+
+bool kjson_schema_add(struct kjson_schema *s, struct kjson_parser *p)
+{
+	if (!s->root && !(s->root = schema_node_new(NULL, 0)))
+		return false;
+	struct schema_cb cb = {
+		.parent = {
+			.leaf    = schema_leaf,
+			.begin   = schema_begin,
+			.a_entry = schema_a_entry,
+			.o_entry = schema_o_entry,
+			.end     = schema_end,
+		},
+		.cur = s->root,
+	};
+	bool r = kjson_parse_mid(p, &cb.parent);
+	free(cb.stack);
+	if (!r)
+		s->errors++;
+	else if (!cb.oom)
+		s->docs++;
+	return r && !cb.oom;
+}
+
+static void schema_len_merge(struct schema_len *into,
+                             const struct schema_len *from)
+{
+	for (unsigned i=0; i<SCHEMA_LEN_BINS; i++)
+		into->bins[i] += from->bins[i];
+	into->sum += from->sum;
+	if (from->min < into->min)
+		into->min = from->min;
+	if (from->max > into->max)
+		into->max = from->max;
+}
+
+static bool schema_node_merge(struct kjson_schema_node *into,
+                              const struct kjson_schema_node *from)
+{
+	for (unsigned i=0; i<SCHEMA_N; i++)
+		into->types[i] += from->types[i];
+	schema_len_merge(&into->str, &from->str);
+	schema_len_merge(&into->arr, &from->arr);
+	if (from->hll) {
+		if (!into->hll && !(into->hll = calloc(SCHEMA_HLL_M, 1)))
+			return false;
+		for (unsigned i=0; i<SCHEMA_HLL_M; i++)
+			if (from->hll[i] > into->hll[i])
+				into->hll[i] = from->hll[i];
+	}
+	size_t hint = 0;
+	for (size_t i=0; i<from->n_child; i++) {
+		const struct kjson_schema_node *c = from->child[i];
+		struct kjson_schema_node *d = schema_child(into, c->key,
+		                                           c->key_len, &hint);
+		if (!d || !schema_node_merge(d, c))
+			return false;
+	}
+	if (from->items && !(schema_items(into) &&
+	                     schema_node_merge(into->items, from->items)))
+		return false;
+	if (from->other) {
+		if (!into->other && !(into->other = schema_node_new(NULL, 0)))
+			return false;
+		if (!schema_node_merge(into->other, from->other))
+			return false;
+	}
+	return true;
+}
+
+bool kjson_schema_merge(struct kjson_schema *into,
+                        const struct kjson_schema *from)
+{
+	into->docs += from->docs;
+	into->errors += from->errors;
+	if (!from->root)
+		return true;
+	if (!into->root && !(into->root = schema_node_new(NULL, 0)))
+		return false;
+	return schema_node_merge(into->root, from->root);
+}
+
+static void schema_indent(FILE *f, int depth)
+{
+	fputc('\n', f);
+	for (int i=0; i<depth; i++)
+		fputc('\t', f);
+}
+
+static void schema_len_print(FILE *f, const char *name,
+                             const struct schema_len *l, size_t count,
+                             int depth)
+{
+	unsigned k = SCHEMA_LEN_BINS;
+	while (k > 1 && !l->bins[k-1])
+		k--;
+	fprintf(f, ",");
+	schema_indent(f, depth);
+	fprintf(f, "\"%s\": {\"min\": %zu, \"max\": %zu, \"mean\": %g, "
+	           "\"histogram\": [", name, l->min, l->max,
+	        (double)l->sum / count);
+	for (unsigned i=0; i<k; i++)
+		fprintf(f, "%s%zu", i ? ", " : "", l->bins[i]);
+	fprintf(f, "]}");
+}
+
+static size_t schema_count(const struct kjson_schema_node *n)
+{
+	size_t count = 0;
+	for (unsigned i=0; i<SCHEMA_N; i++)
+		count += n->types[i];
+	return count;
+}
+
+static void schema_node_print(FILE *f, const struct kjson_schema_node *n,
+                              size_t parent_objects, int depth)
+{
+	size_t count = schema_count(n);
+	fprintf(f, "{");
+	schema_indent(f, depth+1);
+	fprintf(f, "\"count\": %zu", count);
+	if (parent_objects)
+		fprintf(f, ", \"presence\": %g", (double)count / parent_objects);
+	fprintf(f, ",");
+	schema_indent(f, depth+1);
+	fprintf(f, "\"types\": {");
+	for (unsigned i=0, first=1; i<SCHEMA_N; i++)
+		if (n->types[i]) {
+			fprintf(f, "%s\"%s\": %zu", first ? "" : ", ",
+			        schema_type_names[i], n->types[i]);
+			first = 0;
+		}
+	fprintf(f, "}");
+	if (count)
+		fprintf(f, ", \"null_rate\": %g",
+		        (double)n->types[SCHEMA_NULL] / count);
+	if (n->hll)
+		fprintf(f, ", \"distinct\": %.0f", schema_hll_estimate(n->hll));
+	if (n->types[SCHEMA_STRING])
+		schema_len_print(f, "string_length", &n->str,
+		                 n->types[SCHEMA_STRING], depth+1);
+	if (n->types[SCHEMA_ARRAY])
+		schema_len_print(f, "array_length", &n->arr,
+		                 n->types[SCHEMA_ARRAY], depth+1);
+	/* syntax errors may leave nodes without values behind */
+	if (n->items && schema_count(n->items)) {
+		fprintf(f, ",");
+		schema_indent(f, depth+1);
+		fprintf(f, "\"items\": ");
+		schema_node_print(f, n->items, 0, depth+1);
+	}
+	bool fields = false;
+	for (size_t i=0; i<n->n_child; i++) {
+		const struct kjson_schema_node *c = n->child[i];
+		if (!schema_count(c))
+			continue;
+		fprintf(f, ",");
+		if (!fields) {
+			schema_indent(f, depth+1);
+			fprintf(f, "\"fields\": {");
+			fields = true;
+		}
+		schema_indent(f, depth+2);
+		print_string(f, c->key, c->key_len);
+		fprintf(f, ": ");
+		schema_node_print(f, c, n->types[SCHEMA_OBJECT], depth+2);
+	}
+	if (fields) {
+		schema_indent(f, depth+1);
+		fprintf(f, "}");
+	}
+	if (n->other && schema_count(n->other)) {
+		fprintf(f, ",");
+		schema_indent(f, depth+1);
+		fprintf(f, "\"other_fields\": ");
+		schema_node_print(f, n->other, 0, depth+1);
+	}
+	schema_indent(f, depth);
+	fprintf(f, "}");
+}
+
+void kjson_schema_print(FILE *f, const struct kjson_schema *s)
+{
+	fprintf(f, "{\"documents\": %zu, \"errors\": %zu", s->docs, s->errors);
+	if (s->root) {
+		fprintf(f, ", \"schema\": ");
+		schema_node_print(f, s->root, 0, 0);
+	}
+	fprintf(f, "}\n");
+}
+
+void kjson_schema_fini(struct kjson_schema *s)
+{
+	schema_node_free(s->root);
+}
+
+#ifdef KJSON_IMPLEMENTATION
+# undef b64_dec
+# undef compact
+# undef compact_bytes
+# undef compact_copy
+# undef compact_size
+# undef count_upto
+# undef decode_escape
+# undef elem
+# undef ensure_one_left
+# undef error_messages
+# undef fail
+# undef hex4
+# undef high_a_entry
+# undef high_begin
+# undef high_cb
+# undef high_end
+# undef high_leaf
+# undef high_o_entry
+# undef is_hex
+# undef parse_mid2
+# undef plan_add
+# undef plan_value
+# undef print_close
+# undef print_entries
+# undef print_head
+# undef print_open
+# undef print_plan
+# undef print_string
+# undef proj_build
+# undef proj_child
+# undef proj_copy
+# undef proj_node
+# undef proj_seg_eq
+# undef proj_value
+# undef read_string
+# undef redact_key
+# undef redact_value
+# undef schema_a_entry
+# undef schema_begin
+# undef schema_cb
+# undef schema_child
+# undef schema_count
+# undef schema_end
+# undef schema_frame
+# undef schema_hash
+# undef schema_hll_add
+# undef schema_hll_estimate
+# undef schema_indent
+# undef schema_items
+# undef schema_key_is
+# undef schema_leaf
+# undef schema_len
+# undef schema_len_add
+# undef schema_len_merge
+# undef schema_len_print
+# undef schema_ln
+# undef schema_node_free
+# undef schema_node_merge
+# undef schema_node_new
+# undef schema_node_print
+# undef schema_o_entry
+# undef schema_type
+# undef schema_type_names
+# undef skip_leaf
+# undef skip_space
+# undef skip_string
+# undef str_pat
+# undef str_special
+# undef str_special_n
+# undef str_subst1
+# undef top
+# undef validate
+# undef validate_digits
+# undef validate_fail
+# undef validate_key
+# undef validate_number
+# undef validate_space
+# undef validate_string
+# undef validate_uescape
+# undef validate_utf8_seq
+# undef SCHEMA_ARRAY
+# undef SCHEMA_BOOLEAN
+# undef SCHEMA_INTEGER
+# undef SCHEMA_N
+# undef SCHEMA_NULL
+# undef SCHEMA_NUMBER
+# undef SCHEMA_OBJECT
+# undef SCHEMA_STRING
+# undef B64
+# undef COLD
+# undef CONCAT
+# undef ELEM_INIT
+# undef ENSURE_ONE_LEFT
+# undef PROBE
+# undef REPEATED8_16
+# undef REPEATED8_32
+# undef REPEATED8_64
+# undef SCHEMA_HLL_BITS
+# undef SCHEMA_HLL_M
+# undef SCHEMA_LEN_BINS
+# undef SCHEMA_MAX_KEYS
+# undef UL_BITS
+# undef UL_REPEATED8
+# undef VALIDATE_WORD_BITS
+# undef XCONCAT
+#endif
@@ -16,6 +16,25 @@
 #include <stdbool.h>	/* bool, true, false */
 #include <stdint.h>	/* intmax_t */
 
+/* Defining KJSON_IMPLEMENTATION before including this header compiles kjson.c,
+ * which has to reside next to it, into the including translation unit. All
+ * functions but those of the POSIX interface then are static inline, so
+ * decoders built on top of the low-level interface can have them inlined.
+ * Several translation units may do so independently and need neither link
+ * libkjson nor clash with it. Only available in C. The private names of
+ * kjson.c are prefixed by kjson__ in this mode and its macros do not outlive
+ * it, however, the headers it includes remain: <string.h>, <stdlib.h>,
+ * <inttypes.h>, <errno.h>, <assert.h> and <limits.h>, as well as <sys/sdt.h>
+ * if KJSON_USDT is defined. */
+#ifdef KJSON_IMPLEMENTATION
+# ifdef __cplusplus
+#  error "KJSON_IMPLEMENTATION requires C"
+# endif
+# define KJSON_API	static inline
+#else
+# define KJSON_API
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,12 +44,48 @@ extern "C" {
 
 #define KJSON_VERSION	KJSON_VERSION_SPLIT(0,2,1)
 
-uint32_t kjson_version(void);
+KJSON_API uint32_t kjson_version(void);
+
+/* Flags for struct kjson_parser. */
+/* Strings and keys parsed by the mid- and high-level interfaces are only
+ * delimited, not decoded, leaving the source unmodified. Strings containing
+ * escape sequences, which need kjson_string_decode(), are reported as
+ * KJSON_LEAF_STRING_ESCAPED; objects built from raw keys have their raw_keys
+ * flag set. */
+#define KJSON_PARSE_RAW_STRINGS		0x1
+
+/* Kinds of syntax errors, see struct kjson_parser. The last three are only
+ * reported by kjson_validate_err() and, in case of KJSON_ERR_DEPTH, by
+ * kjson_project(). */
+enum kjson_error {
+	KJSON_ERR_NONE,
+	KJSON_ERR_EOF,      /* unexpected end of input */
+	KJSON_ERR_VALUE,    /* expected a value */
+	KJSON_ERR_NUMBER,   /* invalid number */
+	KJSON_ERR_STRING,   /* expected a string, e.g. as key */
+	KJSON_ERR_CONTROL,  /* unescaped control character in string */
+	KJSON_ERR_ESCAPE,   /* invalid escape sequence */
+	KJSON_ERR_COLON,    /* expected ':' */
+	KJSON_ERR_COMMA,    /* expected ',' or the end of the composite */
+	KJSON_ERR_UTF8,     /* invalid UTF-8 */
+	KJSON_ERR_DEPTH,    /* nested deeper than KJSON_VALIDATE_MAX_DEPTH */
+	KJSON_ERR_TRAILING, /* characters after the value */
+	KJSON_ERR_N
+};
 
 struct kjson_parser {
 	char *s;
+	unsigned flags;
+	/* Only written when parsing fails: the kind of error and where it was
+	 * detected, e.g. the offending byte. Not reset on success. Set by the
+	 * mid- and high-level parsers, kjson_skip() and the string readers. */
+	enum kjson_error error;
+	const char *error_at;
 };
 
+/* Returns a static description of err. */
+KJSON_API const char * kjson_strerror(enum kjson_error err);
+
 enum kjson_value_type {
 	KJSON_VALUE_NULL,
 	KJSON_VALUE_BOOLEAN,
@@ -38,6 +93,9 @@ enum kjson_value_type {
 	KJSON_VALUE_STRING,
 	KJSON_VALUE_ARRAY,
 	KJSON_VALUE_OBJECT,
+	/* only under KJSON_PARSE_RAW_STRINGS: a string whose raw contents
+	 * contain JSON escape sequences */
+	KJSON_VALUE_STRING_ESCAPED,
 	KJSON_VALUE_N
 };
 
@@ -50,8 +108,8 @@ struct kjson_string {
  * low-level interface (no composite values, no allocations)
  * -------------------------------------------------------------------------- */
 
-bool kjson_read_bool(struct kjson_parser *p, bool *v);
-bool kjson_read_null(struct kjson_parser *p);
+KJSON_API bool kjson_read_bool(struct kjson_parser *p, bool *v);
+KJSON_API bool kjson_read_null(struct kjson_parser *p);
 
 /* Parses a JSON string entry into a '\0'-terminated UTF-8 string at *begin,
  * decoding any escaped characters (including surrogate pairs). len is optional
@@ -59,7 +117,39 @@ bool kjson_read_null(struct kjson_parser *p);
  * On success, *begin will point into the original source, i.e., the source
  * string will be overwritten.
  */
-bool kjson_read_string_utf8(struct kjson_parser *p, char **begin, size_t *len);
+KJSON_API bool
+kjson_read_string_utf8(struct kjson_parser *p, char **begin, size_t *len);
+
+/* Parses a JSON string entry without decoding it: *s is set to the raw
+ * contents between the quotes, which are neither modified nor
+ * '\0'-terminated. *escaped tells whether they contain escape sequences, that
+ * is, a '\\'. */
+KJSON_API bool
+kjson_read_string_raw(struct kjson_parser *p, struct kjson_string *s,
+                      bool *escaped);
+
+/* Decodes the raw string *s into a '\0'-terminated UTF-8 string at out, which
+ * may be equal to s->begin and has to provide space for s->len+1 bytes.
+ * len is optional and, if non-NULL, on success will contain its length. */
+KJSON_API bool
+kjson_string_decode(const struct kjson_string *s, char *out, size_t *len);
+
+/* Decodes the base64-encoded (RFC 4648, padding is optional) characters
+ * src[0..n-1] into dst, which may be equal to src, and stores the number of
+ * bytes written in *len, if non-NULL. Padding is only accepted if it completes
+ * the last group of 4 characters, and the bits of that group not making up a
+ * byte have to be zero. Characters are not checked ahead of decoding, so on
+ * failure dst[] may have been partly written. */
+KJSON_API bool
+kjson_base64_decode(char *dst, const char *src, size_t n, size_t *len);
+
+/* Parses a JSON string entry and decodes its base64-encoded contents in place.
+ * On success, *begin points into the original source, which has been
+ * overwritten by the *len decoded bytes. They are not '\0'-terminated. On
+ * invalid base64, the string may be left partly overwritten, as by
+ * kjson_read_string_utf8() on invalid escapes. */
+KJSON_API bool kjson_read_string_base64(struct kjson_parser *p, char **begin,
+                                        size_t *len);
 
 struct kjson_number {
 	char *integer;
@@ -74,17 +164,53 @@ union kjson_leaf_raw {
 	struct kjson_string s;
 };
 
-int kjson_read_number(struct kjson_parser *p, union kjson_leaf_raw *leaf);
+KJSON_API int
+kjson_read_number(struct kjson_parser *p, union kjson_leaf_raw *leaf);
+
+/* Advances p->s past any JSON whitespace. */
+KJSON_API void kjson_skip_space(struct kjson_parser *p);
+
+/* Advances p->s past the next JSON value, checking its syntax in the same way
+ * as kjson_parse_mid() does, but without modifying the source. */
+KJSON_API bool kjson_skip(struct kjson_parser *p);
+
+/* Stores the number of elements of the array or entries of the object at p->s
+ * in *n and advances p->s past it. Only strings, commas and the nesting of
+ * brackets are inspected: missing and trailing elements such as in [1,] are
+ * rejected and the closing bracket has to match the opening one, but neither
+ * the syntax of the elements nor the kind of nested brackets is checked.
+ * Leaves are not decoded and the source is not modified. */
+KJSON_API bool kjson_count_elements(struct kjson_parser *p, size_t *n);
+
+#define KJSON_VALIDATE_MAX_DEPTH	4096
+
+/* Checks whether buf[0..len-1] is exactly one JSON value surrounded by optional
+ * whitespace, with escapes checked as by the parsers and composites nested at
+ * most KJSON_VALIDATE_MAX_DEPTH levels deep. buf is neither modified nor
+ * required to be '\0'-terminated and no memory is allocated. */
+KJSON_API bool kjson_validate(const char *buf, size_t len);
+
+/* Like kjson_validate(), but additionally requires strings to be valid UTF-8
+ * (RFC 3629), i.e., without overlong encodings and surrogates. */
+KJSON_API bool kjson_validate_utf8(const char *buf, size_t len);
+
+/* Like kjson_validate() or, if utf8 is set, kjson_validate_utf8(). On failure,
+ * additionally stores the kind of error in *err and the offset into buf where
+ * it was detected in *off. */
+KJSON_API bool
+kjson_validate_err(const char *buf, size_t len, bool utf8,
+                   enum kjson_error *err, size_t *off);
 
 /* --------------------------------------------------------------------------
  * mid-level interface (callback-based parser, no allocations)
  * -------------------------------------------------------------------------- */
 
 enum kjson_leaf_type {
-	KJSON_LEAF_NULL    = KJSON_VALUE_NULL,
-	KJSON_LEAF_BOOLEAN = KJSON_VALUE_BOOLEAN,
-	KJSON_LEAF_NUMBER  = KJSON_VALUE_NUMBER,
-	KJSON_LEAF_STRING  = KJSON_VALUE_STRING,
+	KJSON_LEAF_NULL           = KJSON_VALUE_NULL,
+	KJSON_LEAF_BOOLEAN        = KJSON_VALUE_BOOLEAN,
+	KJSON_LEAF_NUMBER         = KJSON_VALUE_NUMBER,
+	KJSON_LEAF_STRING         = KJSON_VALUE_STRING,
+	KJSON_LEAF_STRING_ESCAPED = KJSON_VALUE_STRING_ESCAPED,
 	KJSON_LEAF_N
 };
 
@@ -124,14 +250,47 @@ struct kjson_mid_cb {
 };
 
 /* requires stack space linear in the depth of the document */
-bool kjson_parse_mid_rec(struct kjson_parser *p, const struct kjson_mid_cb *c);
+KJSON_API bool
+kjson_parse_mid_rec(struct kjson_parser *p, const struct kjson_mid_cb *c);
 
 /* requires only constant stack space, on my laptop same speed or a bit faster
- * than kjson_parse_mid_rec() */
-bool kjson_parse_mid(struct kjson_parser *p, const struct kjson_mid_cb *c);
+ * than kjson_parse_mid_rec(); as it does not remember the kinds of enclosing
+ * composites, a bad key after a nested composite in an object, e.g. in
+ * {"a":[1],"b" 1}, is reported as KJSON_ERR_COMMA instead of KJSON_ERR_COLON or
+ * KJSON_ERR_STRING */
+KJSON_API bool
+kjson_parse_mid(struct kjson_parser *p, const struct kjson_mid_cb *c);
+
+KJSON_API bool
+kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
+                 union kjson_leaf_raw *l);
+
+/* Callbacks for sequences of JSON documents. */
+struct kjson_many_cb {
+	/* Called for the idx-th document with p->s pointing to its first byte.
+	 * Has to parse exactly one value, e.g. using kjson_parse_mid(), and
+	 * return whether that succeeded. */
+	bool (*doc)(const struct kjson_many_cb *c, struct kjson_parser *p,
+	            size_t idx);
+
+	/* Optional, called by kjson_parse_many_parallel() with the number of
+	 * documents before any call to doc(). */
+	void (*count)(const struct kjson_many_cb *c, size_t n);
+};
+
+/* Returns a pointer to the first byte in s[0..end-s-1] that is neither JSON
+ * whitespace nor the record separator 0x1E of RFC 7464, or end. */
+KJSON_API char * kjson_skip_separators(char *s, const char *end);
 
-bool kjson_parse_mid2(struct kjson_parser *p, const struct kjson_mid_cb *c,
-                      union kjson_leaf_raw *l);
+/* Parses the sequence of JSON documents in buf[0..len-1], which has to be
+ * followed by a '\0', one after the other by calling c->doc() for each.
+ * Documents may follow each other directly or be separated by whitespace or
+ * the record separator 0x1E of JSON text sequences (RFC 7464), newlines are
+ * not required. p->flags is set to flags. On success, *n is the number of
+ * documents, else the index of the one that could not be parsed. */
+KJSON_API bool
+kjson_parse_many(char *buf, size_t len, const struct kjson_many_cb *c,
+                 unsigned flags, size_t *n);
 
 /* --------------------------------------------------------------------------
  * high-level interface (dynamically build tree structure)
@@ -147,6 +306,9 @@ struct kjson_array {
 struct kjson_object {
 	struct kjson_object_entry *data;
 	size_t n;
+	/* The keys are raw as under KJSON_PARSE_RAW_STRINGS and may contain
+	 * escape sequences. */
+	bool raw_keys;
 };
 
 struct kjson_value {
@@ -171,15 +333,307 @@ typedef void kjson_store_leaf_f(struct kjson_value *v,
                                 enum kjson_leaf_type type,
                                 union kjson_leaf_raw *l);
 
-bool kjson_parse(struct kjson_parser *p, struct kjson_value *v);
-bool kjson_parse2(struct kjson_parser *p, struct kjson_value *v,
-                  kjson_read_other_f *read_other,
-                  kjson_store_leaf_f *store_leaf);
-void kjson_value_print(FILE *f, const struct kjson_value *v);
-void kjson_value_fini(const struct kjson_value *v);
+KJSON_API bool kjson_parse(struct kjson_parser *p, struct kjson_value *v);
+KJSON_API bool kjson_parse2(struct kjson_parser *p, struct kjson_value *v,
+                            kjson_read_other_f *read_other,
+                            kjson_store_leaf_f *store_leaf);
+KJSON_API void kjson_value_print(FILE *f, const struct kjson_value *v);
+KJSON_API void kjson_value_fini(const struct kjson_value *v);
+
+/* Printing in parts: kjson_value_print_plan() splits the output of
+ * kjson_value_print(f, v) into chunks which, printed in order by
+ * kjson_value_print_chunk(), produce the same output. Each chunk covers at
+ * most about 'grain' values; composites with more values are split. *chunks
+ * is set to an array allocated by malloc(3). Returns the number of
+ * chunks or 0 if memory could not be allocated. */
+
+enum kjson_print_part {
+	KJSON_PRINT_VALUE,   /* the whole value *v */
+	KJSON_PRINT_OPEN,    /* opening bracket of *v */
+	KJSON_PRINT_ENTRIES, /* entries lo..hi-1 of *v, including separators */
+	KJSON_PRINT_HEAD,    /* separator and key preceding entry lo of *v */
+	KJSON_PRINT_CLOSE,   /* closing bracket of *v */
+};
+
+struct kjson_print_chunk {
+	enum kjson_print_part part;
+	const struct kjson_value *v;
+	size_t lo, hi;
+	int depth;
+};
+
+KJSON_API size_t
+kjson_value_print_plan(const struct kjson_value *v, size_t grain,
+                       struct kjson_print_chunk **chunks);
+KJSON_API void
+kjson_value_print_chunk(FILE *f, const struct kjson_print_chunk *c);
+
+/* Returns a copy of *v which does not reference the source parsed into *v or
+ * any other memory: the tree and the contents of its strings, numbers and
+ * keys are stored in a single, exactly sized allocation in depth-first order.
+ * Strings and keys remain '\0'-terminated, numbers are as well. The result
+ * has to be released using free(3) instead of kjson_value_fini(). Returns NULL
+ * if memory could not be allocated. */
+KJSON_API struct kjson_value *
+kjson_value_clone_compact(const struct kjson_value *v);
+
+/* Returns the first entry in o whose key equals key[0..len-1] or NULL if there
+ * is none. */
+KJSON_API const struct kjson_object_entry *
+kjson_object_find(const struct kjson_object *o, const char *key, size_t len);
+
+/* --------------------------------------------------------------------------
+ * rewriting interface (copy raw source ranges, no tree structure)
+ * -------------------------------------------------------------------------- */
+
+/* Writes the JSON value at p->s to out, keeping only the parts selected by the
+ * NULL-terminated array 'paths' of JSON Pointers (RFC 6901), e.g. "/user/id".
+ * Arrays are transparent, i.e., the path applies to each of their elements,
+ * and keys are compared in their raw JSON spelling. Selected subtrees are
+ * copied byte-by-byte, everything else is skipped, as are object entries and
+ * array elements whose value is not a composite along a path. out has to
+ * provide at least as much space as the source value takes up and may be equal
+ * to p->s. On success, *len is the length of the output, which is not
+ * '\0'-terminated. Returns false on invalid paths, syntax errors, composites
+ * nested more than KJSON_VALIDATE_MAX_DEPTH levels deep or if memory could not
+ * be allocated. */
+KJSON_API bool
+kjson_project(struct kjson_parser *p, const char *const *paths, char *out,
+              size_t *len);
+
+enum kjson_redact_mode {
+	/* Overwrite values by placeholders of the same width: "***" for
+	 * strings, null or 0 for other values, padded with spaces. Lengths of
+	 * short strings are kept. */
+	KJSON_REDACT_MASK,
+	/* Same placeholders without padding, moving the remainder of the value
+	 * towards its beginning. */
+	KJSON_REDACT_COMPACT,
+};
+
+/* Replaces the values of all object entries in the JSON value at p->s whose
+ * key, in its raw JSON spelling, is in the NULL-terminated array 'keys' by a
+ * placeholder and advances p->s past the value. On success, *len, if non-NULL,
+ * is the length of the rewritten value, which starts where p->s did. Syntax is
+ * checked as in kjson_skip(). Values are replaced while scanning, so on a
+ * syntax error the value is left partly rewritten: the values before the
+ * error are redacted and, in KJSON_REDACT_COMPACT mode, the source up to the
+ * last of them has been moved towards its beginning, leaving stale bytes
+ * behind. */
+KJSON_API bool kjson_redact(struct kjson_parser *p, const char *const *keys,
+                            enum kjson_redact_mode mode, size_t *len);
+
+/* --------------------------------------------------------------------------
+ * schema inference interface (statistics over many documents, no DOM)
+ * -------------------------------------------------------------------------- */
+
+struct kjson_schema_node;
+
+/* Summary of the paths occurring in a set of documents. */
+struct kjson_schema {
+	size_t docs;   /* number of documents added */
+	size_t errors; /* number of documents rejected due to syntax errors */
+	/* private */
+	struct kjson_schema_node *root;
+};
+
+#define KJSON_SCHEMA_INIT	{ 0, 0, NULL }
+
+/* Parses the JSON value at p->s using kjson_parse_mid() and records each of
+ * its values under its path in *s: the types seen, the number of nulls, an
+ * estimate of the number of distinct strings and numbers (by spelling) and
+ * the lengths of strings and arrays. Elements of arrays share the path of
+ * the array. At most 256 different keys are kept per object path, further
+ * ones are summarized together. Returns false on syntax errors, which are
+ * counted in s->errors, or if memory could not be allocated, leaving
+ * s->errors unchanged; in both cases, the values preceding the error have
+ * been recorded. */
+KJSON_API bool kjson_schema_add(struct kjson_schema *s, struct kjson_parser *p);
+
+/* Adds the statistics collected in *from to *into. Returns false if memory
+ * could not be allocated. */
+KJSON_API bool kjson_schema_merge(struct kjson_schema *into,
+                                  const struct kjson_schema *from);
+
+/* Prints *s as a JSON object of the form
+ *   {"documents": D, "errors": E, "schema": N}
+ * where each node N describes one path by the members
+ *   "count", number of values;
+ *   "presence", fraction of the parent's objects containing the key;
+ *   "types", mapping "null", "boolean", "integer", "number", "string",
+ *            "array" and "object" to the number of their occurrences;
+ *   "null_rate", fraction of nulls;
+ *   "distinct", estimated number of distinct strings and numbers;
+ *   "string_length" and "array_length", objects with "min", "max", "mean"
+ *            and "histogram" [n0, n1, ...] where n0 counts length 0 and ni
+ *            lengths in [2^(i-1), 2^i);
+ *   "items", node of the array elements;
+ *   "fields" and "other_fields", object mapping keys to nodes and the node
+ *            summarizing the keys exceeding the limit.
+ * Members not applicable to a path are omitted. */
+KJSON_API void kjson_schema_print(FILE *f, const struct kjson_schema *s);
+
+KJSON_API void kjson_schema_fini(struct kjson_schema *s);
+
+/* --------------------------------------------------------------------------
+ * POSIX interface (threads, file descriptors; link with -pthread)
+ * -------------------------------------------------------------------------- */
+
+struct kjson_visitor {
+	/* Called once for every value in the tree, with the accumulator of the
+	 * calling thread. Values are visited concurrently and in no particular
+	 * order. */
+	void (*visit)(const struct kjson_visitor *vis,
+	              const struct kjson_value *v, void *acc);
+
+	/* Called after all values have been visited to merge each thread's
+	 * accumulator 'from' into 'into'. Only used if acc_size is non-zero. */
+	void (*reduce)(const struct kjson_visitor *vis, void *into,
+	               const void *from);
+
+	/* Size of the per-thread accumulators, which initially are all-zero. */
+	size_t acc_size;
+};
+
+/* Calls vis->visit() on *v and all values contained in it using a
+ * work-stealing pool of nthreads threads (0 means one per online CPU), the
+ * calling thread being one of them. Large arrays and objects are split into
+ * ranges of children which idle threads steal. Finally, the per-thread
+ * accumulators are reduced into *acc. Returns false if memory could not be
+ * allocated. */
+bool kjson_visit_parallel(const struct kjson_value *v,
+                          const struct kjson_visitor *vis, unsigned nthreads,
+                          void *acc);
+
+/* Writes the same output as kjson_value_print() to the file descriptor fd.
+ * Chunks of the output are printed into memory by nthreads threads (0 means
+ * one per online CPU), the calling thread being one of them, and written in
+ * order using writev(2) by the calling thread; only a bounded number of
+ * chunks is buffered at any time. If threads cannot be created, the calling
+ * thread prints all chunks. Returns false on errors, in which case errno is
+ * set. */
+bool kjson_value_write_parallel(int fd, const struct kjson_value *v,
+                                unsigned nthreads);
+
+struct iovec;
+struct kjson_iov_block;
+
+/* List of buffers, e.g., for writev(2), containing compact JSON. */
+struct kjson_iov {
+	struct iovec *iov;
+	size_t n;
+	/* private */
+	size_t cap;
+	struct kjson_iov_block *blocks;
+};
+
+#define KJSON_IOV_INIT	{ NULL, 0, 0, NULL }
+
+/* Appends *v as compact JSON to *out. String contents and keys not requiring
+ * escapes are referenced in place, unless they are short, as are raw strings
+ * (see KJSON_PARSE_RAW_STRINGS); everything else is copied into memory owned by
+ * *out and adjacent small fragments are merged. Thus, the source parsed into
+ * *v has to outlive the use of out->iov. Returns false if memory could not be
+ * allocated. */
+bool kjson_value_iov(struct kjson_iov *out, const struct kjson_value *v);
+
+/* Writes all of out->iov to fd, see kjson_value_write_parallel() for the
+ * return value. */
+bool kjson_iov_write(int fd, const struct kjson_iov *out);
+
+void kjson_iov_fini(struct kjson_iov *out);
+
+/* Adds each non-blank line of the NDJSON buf[0..len-1], which has to be
+ * writable and followed by a '\0', to *s as kjson_schema_add() does, while
+ * requiring nothing but whitespace after each document. Ranges of lines are
+ * processed in parallel by nthreads threads (0 means one per online CPU) into
+ * separate schemas, which are merged into *s at the end. Returns false if
+ * memory could not be allocated; syntax errors are only counted in
+ * s->errors. */
+bool kjson_schema_ndjson(struct kjson_schema *s, char *buf, size_t len,
+                         unsigned nthreads);
+
+/* Like kjson_parse_many(), but the documents are first located by a read-only
+ * pass over buf using kjson_count_elements() and kjson_skip(), then c->doc() is
+ * called concurrently for batches of them by nthreads threads (0 means one per
+ * online CPU). The documents in the last few bytes of each batch are only
+ * parsed by the calling thread after the others finished, so that no thread
+ * reads bytes another one decodes in place. On failure, *n is the smallest
+ * index of a document that could not be located or parsed; documents after it
+ * may have been parsed nonetheless. Also fails if memory could not be
+ * allocated, with *n set to 0. */
+bool kjson_parse_many_parallel(char *buf, size_t len,
+                               const struct kjson_many_cb *c, unsigned flags,
+                               unsigned nthreads, size_t *n);
+
+/* Calls c->doc() for each non-blank line of the NDJSON read from fd until end
+ * of file, requiring nothing but whitespace after each document. Blocks are
+ * read ahead by a separate thread into a bounded ring of buffers while the
+ * calling thread parses the lines in the blocks already read, in place. If a
+ * document cannot be parsed, returns false with *n being its index and errno
+ * set to 0; on read errors or if memory could not be allocated, returns false
+ * with errno set and *n being the number of documents parsed. */
+bool kjson_parse_fd(int fd, const struct kjson_many_cb *c, unsigned flags,
+                    size_t *n);
+
+/* A file processed by kjson_batch(). */
+struct kjson_batch_file {
+	char *path;
+	/* size in bytes; if 0, determined by kjson_batch() */
+	size_t size;
+	/* results: whether c->file() succeeded, otherwise the errno of a
+	 * failed system call or 0, and the time spent in seconds */
+	bool ok;
+	int err;
+	double seconds;
+};
+
+struct kjson_batch_cb {
+	/* Called for each file with p->s pointing to its contents, which are
+	 * '\0'-terminated after len bytes and may be modified, and with the
+	 * context of the calling thread. Files are processed concurrently. */
+	bool (*file)(const struct kjson_batch_cb *c, struct kjson_parser *p,
+	             size_t len, struct kjson_batch_file *f, void *ctx);
+
+	/* Optional, called for each thread's context at the end. */
+	void (*fini)(const struct kjson_batch_cb *c, void *ctx);
+
+	/* Size of the per-thread contexts, which initially are all-zero. */
+	size_t ctx_size;
+};
+
+struct kjson_batch_stats {
+	size_t files, failed, bytes;
+	double seconds; /* wall-clock time */
+};
+
+/* Calls c->file() for each of files[0..n-1] using nthreads threads (0 means
+ * one per online CPU). The files are processed from the largest to the
+ * smallest, each thread taking the next file once it is done with its last
+ * one. Large files are mapped into memory privately, small ones are read into
+ * a buffer of the thread. If st is non-NULL, the totals are stored in *st.
+ * Returns false if memory could not be allocated. */
+bool kjson_batch(struct kjson_batch_file *files, size_t n,
+                 const struct kjson_batch_cb *c, unsigned nthreads,
+                 struct kjson_batch_stats *st);
+
+/* Appends the regular files in the directory tree at path, or path itself if
+ * it is not a directory, to *files, which has *n entries and is reallocated
+ * as needed, so it has to be NULL or come from this function; their sizes are
+ * set. Symbolic links to directories inside the tree are not followed.
+ * Returns false with errno set on errors. */
+bool kjson_batch_collect(const char *path, struct kjson_batch_file **files,
+                         size_t *n);
+
+/* Frees the paths in files[0..n-1] and files. */
+void kjson_batch_free(struct kjson_batch_file *files, size_t n);
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef KJSON_IMPLEMENTATION
+# include "kjson.c"
+#endif
+
 #endif
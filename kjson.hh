@@ -79,6 +79,53 @@
  *
  * would set g to -17.
  *
+ * For int32_t, int64_t, uint64_t, double and float, .get<T>() does not call
+ * from_chars() but uses the positions of the fraction and exponent recorded by
+ * kjson_read_number() to convert integers directly and floating point numbers
+ * via Clinger's fast path whenever it is exact, which covers most numbers in
+ * practice.  Defining KJSON_BUILTIN_NUMBERS before including this header
+ * specializes requests_number<T> for all of them; alternatively, they can be
+ * enabled one by one as shown above.
+ *
+ * kjson::decimal represents numbers exactly as coefficient and power of ten,
+ * e.g., for monetary values; .get<kjson::decimal>() is always available.
+ *
+ * A third variant, kjson::json_exp, neither throws nor discards the error:
+ * its operations return kjson::expected<T>, which is std::expected<T,error> if
+ * the standard library provides it and a small equivalent otherwise.  It suits
+ * code probing for keys that are frequently absent, where exceptions would be
+ * thrown on the common path:
+ *
+ *   if (auto x = v["key3"]; x)
+ *     use(*x);
+ *   else if (x.error() != kjson::error::KEY_NOT_FOUND)
+ *     ...
+ *
+ * Reading several fields of an object in document order is best done via
+ * .reader(), which returns a kjson::object_reader continuing each search where
+ * the previous one ended:
+ *
+ *   auto r = v["key1"][1].reader();
+ *   std::string_view s = r["key2"].get<std::string_view>();
+ *
+ * Arrays are ranges: begin() and end() return random-access iterators, thus
+ * e.g. std::lower_bound() or parallel algorithms apply to them directly:
+ *
+ *   auto a = v["key1"];
+ *   std::for_each(std::execution::par, a.begin(), a.end(), f);
+ *
+ * Like all values, the iterators and the values they yield share ownership of
+ * the document.  Parallel algorithms copy iterators a lot, each copy touching
+ * the reference count common to all threads; .borrowed() returns a range over
+ * the same elements whose iterators, the values they yield and those obtained
+ * from these only borrow the document instead:
+ *
+ *   auto r = a.borrowed();
+ *   std::for_each(std::execution::par, r.begin(), r.end(), f);
+ *
+ * Another kjson::json{,_opt,_exp} referring to the document, here a, has to
+ * outlive them.
+ *
  * Both, kjson::kjson and kjson::kjson_opt, at the moment use std::shared_ptr in
  * order to manage the "reference semantics" view that the C library kjson
  * assumes: the string given to kjson_parse() is assumed to exist while the
@@ -93,12 +140,19 @@
  * the whole point of the C implementation.  Thus, here is a clear clash between
  * the views from C and from C++ and the most portable solution was by using the
  * heap and reference-count the parsed string object.
+ *
+ * Lookups by key in objects with many keys use a hash index built on first
+ * use and shared by all copies referring to the same document.  Indexes are
+ * published atomically, so a document may be read concurrently by several
+ * threads without further synchronization.  The first such lookup in a
+ * document walks all of it once to size the table of indexes.
  */
 
 #ifndef JSON_CC_HH
 #define JSON_CC_HH
 
 #include <vector>
+#include <algorithm>	/* copy() */
 #include <string_view>
 #include <cstring>	/* memcmp */
 #include <cassert>
@@ -106,7 +160,14 @@
 #include <iostream>
 #include <sstream>
 #include <memory>
+#include <atomic>
 #include <charconv>	/* from_chars() */
+#include <cstdint>	/* int32_t, int64_t, uint64_t */
+#include <limits>
+#include <iterator>
+#if __has_include(<expected>)
+# include <expected>
+#endif
 
 #include <kjson.h>
 
@@ -114,12 +175,168 @@ namespace kjson {
 
 namespace detail {
 
+/* Hash index of the keys of a single object: slot[] holds entry indices + 1
+ * (0 meaning empty) at positions derived from the hashes of their keys. */
+class key_index {
+
+	static constexpr uint32_t DUP = UINT32_C(1) << 31;
+
+	const ::kjson_object &o;
+	size_t mask;
+	std::unique_ptr<uint32_t[]> slot;
+
+	static size_t hash(const char *s, size_t n)
+	{
+		uint64_t h = UINT64_C(0xcbf29ce484222325); /* FNV-1a */
+		for (size_t i=0; i<n; i++)
+			h = (h ^ (unsigned char)s[i]) * UINT64_C(0x100000001b3);
+		return h ^ h >> 32;
+	}
+
+	bool eq(uint32_t e, std::string_view sv) const
+	{
+		const ::kjson_string &k = o.data[(e & ~DUP) - 1].key;
+		return sv.length() == k.len && !memcmp(sv.data(), k.begin, k.len);
+	}
+
+public:
+	explicit key_index(const ::kjson_object &o)
+	: o(o)
+	{
+		size_t cap = 2;
+		while (cap < 2 * o.n)
+			cap *= 2;
+		mask = cap - 1;
+		slot = std::make_unique<uint32_t[]>(cap);
+		for (size_t i=0; i<o.n; i++) {
+			std::string_view k { o.data[i].key.begin, o.data[i].key.len };
+			size_t j = hash(k.data(), k.length()) & mask;
+			for (; slot[j] && !eq(slot[j], k); j = (j+1) & mask);
+			if (slot[j])
+				slot[j] |= DUP;
+			else
+				slot[j] = i+1;
+		}
+	}
+
+	/* Returns the index of the entry with key sv, o.n if there is none and
+	 * o.n+1 if there are several. */
+	size_t find(std::string_view sv) const
+	{
+		size_t j = hash(sv.data(), sv.length()) & mask;
+		for (; slot[j]; j = (j+1) & mask)
+			if (eq(slot[j], sv))
+				return slot[j] & DUP ? o.n+1 : (slot[j] & ~DUP) - 1;
+		return o.n;
+	}
+};
+
+/* Maps the objects of a document having at least MIN_KEYS keys to their
+ * key_index, built on first use.  There is a slot for each such object, so
+ * lookups and insertions need no locks: slots and indexes are claimed and
+ * published by compare-and-swap, a thread losing a race just discards the
+ * index it built.  The table is sized by walking the whole document. */
+class index_table {
+
+	size_t mask;
+	std::unique_ptr<std::atomic<const ::kjson_object *>[]> objs;
+	std::unique_ptr<std::atomic<const key_index *>[]> idxs;
+
+	static size_t count(const ::kjson_value &v)
+	{
+		size_t r = 0;
+		if (v.type == KJSON_VALUE_ARRAY)
+			for (size_t i=0; i<v.a.n; i++)
+				r += count(v.a.data[i]);
+		else if (v.type == KJSON_VALUE_OBJECT) {
+			r += v.o.n >= MIN_KEYS;
+			for (size_t i=0; i<v.o.n; i++)
+				r += count(v.o.data[i].value);
+		}
+		return r;
+	}
+
+	/* Objects are at least 8-aligned and, e.g., libstdc++ hashes pointers
+	 * to themselves, so mix the address bits (Fibonacci hashing) before
+	 * masking to spread the start slots. */
+	size_t slot(const ::kjson_object &o) const
+	{
+		uint64_t h = (uint64_t)((uintptr_t)&o >> 3);
+		return (h * UINT64_C(0x9e3779b97f4a7c15)) >> 32 & mask;
+	}
+
+public:
+	static constexpr size_t MIN_KEYS = 16;
+
+	explicit index_table(const ::kjson_value &root)
+	{
+		size_t cap = 2, n = count(root);
+		while (cap < 2 * n)
+			cap *= 2;
+		mask = cap - 1;
+		objs = std::make_unique<std::atomic<const ::kjson_object *>[]>(cap);
+		idxs = std::make_unique<std::atomic<const key_index *>[]>(cap);
+	}
+
+	~index_table()
+	{
+		for (size_t i=0; i<=mask; i++)
+			delete idxs[i].load(std::memory_order_relaxed);
+	}
+
+	const key_index & get(const ::kjson_object &o)
+	{
+		size_t j = slot(o);
+		for (;; j = (j+1) & mask) {
+			const ::kjson_object *p = objs[j].load(std::memory_order_acquire);
+			if (!p && objs[j].compare_exchange_strong(p, &o,
+			                                          std::memory_order_acq_rel))
+				p = &o;
+			if (p == &o)
+				break;
+		}
+		const key_index *ix = idxs[j].load(std::memory_order_acquire);
+		if (!ix) {
+			auto mine = std::make_unique<key_index>(o);
+			if (idxs[j].compare_exchange_strong(ix, mine.get(),
+			                                    std::memory_order_acq_rel))
+				ix = mine.release();
+		}
+		return *ix;
+	}
+};
+
+/* The parsed document: its root value, the lazily created index_table and,
+ * in base<T>, the source string the values point into. */
+struct doc : ::kjson_value {
+	mutable std::atomic<index_table *> indexes { nullptr };
+
+	doc() : ::kjson_value KJSON_VALUE_INIT {}
+	doc(const doc &) = delete;
+	virtual ~doc()
+	{
+		delete indexes.load(std::memory_order_relaxed);
+		kjson_value_fini(this);
+	}
+
+	const key_index & index(const ::kjson_object &o) const
+	{
+		index_table *t = indexes.load(std::memory_order_acquire);
+		if (!t) {
+			auto mine = std::make_unique<index_table>(*this);
+			if (indexes.compare_exchange_strong(t, mine.get(),
+			                                    std::memory_order_acq_rel))
+				t = mine.release();
+		}
+		return t->get(o);
+	}
+};
+
 template <typename T>
-struct base : ::kjson_value {
+struct base : doc {
 	T str;
 	base(T str)
-	: ::kjson_value KJSON_VALUE_INIT
-	, str(std::move(str))
+	: str(std::move(str))
 	{}
 	inline char * data();
 };
@@ -128,15 +345,271 @@ template <> inline char * base<char *>::data() { return str; }
 template <> inline char * base<std::string>::data() { return str.data(); }
 
 template <typename Opt> class arr_itr;
+template <typename Opt> class arr_range;
 
 }
 
+template <typename Opt> class object_reader;
+
 template <typename T> struct requests_string : std::false_type {};
 template <> struct requests_string<std::string> : std::true_type {};
 template <> struct requests_string<std::string_view> : std::true_type {};
 
 template <typename T> struct requests_number : std::false_type {};
 
+#ifdef KJSON_BUILTIN_NUMBERS
+template <> struct requests_number<int32_t> : std::true_type {};
+template <> struct requests_number<int64_t> : std::true_type {};
+template <> struct requests_number<uint64_t> : std::true_type {};
+template <> struct requests_number<double> : std::true_type {};
+template <> struct requests_number<float> : std::true_type {};
+#endif
+
+namespace detail {
+
+/* Types whose numbers get<T>() converts via read_number() below. */
+template <typename T> struct builtin_number : std::false_type {};
+template <> struct builtin_number<int32_t> : std::true_type {};
+template <> struct builtin_number<int64_t> : std::true_type {};
+template <> struct builtin_number<uint64_t> : std::true_type {};
+template <> struct builtin_number<double> : std::true_type {};
+template <> struct builtin_number<float> : std::true_type {};
+
+/* Converts the number n, whose syntax kjson_read_number() has checked, to r. */
+template <typename T>
+bool read_number(const ::kjson_number &n, T &r)
+{
+	const char *s = n.integer;
+	bool neg = *s == '-';
+	s += neg;
+	if constexpr (std::is_integral_v<T>) {
+		if (n.fractional != n.end)
+			return false;
+		/* up to 19 digits fit into uint64_t, there are no leading
+		 * zeros */
+		const char *e = n.fractional;
+		if (e - s > 20)
+			return false;
+		uint64_t w = 0;
+		for (const char *m = e - s == 20 ? e-1 : e; s < m; s++)
+			w = 10*w + (*s - '0');
+		if (s < e) {
+			unsigned d = *s - '0';
+			if (w > (UINT64_MAX - d) / 10)
+				return false;
+			w = 10*w + d;
+		}
+		if constexpr (std::is_signed_v<T>) {
+			using U = std::make_unsigned_t<T>;
+			if (w > (U)std::numeric_limits<T>::max() + neg)
+				return false;
+			r = neg && w ? -(T)(w-1) - 1 : (T)w;
+		} else {
+			if ((neg && w) || w > std::numeric_limits<T>::max())
+				return false;
+			r = w;
+		}
+		return true;
+	} else {
+		/* Clinger's fast path: if the significand and the power of 10
+		 * are exactly representable, a single multiplication or
+		 * division rounds correctly. */
+		static constexpr double p10[] = {
+			1e0 , 1e1 , 1e2 , 1e3 , 1e4 , 1e5 , 1e6 , 1e7 ,
+			1e8 , 1e9 , 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+			1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+		};
+		constexpr int max_p10 = std::is_same_v<T,float> ? 10 : 22;
+		const char *f = n.fractional;
+		const char *x = n.exponent;
+		long nf = x > f ? x - f - 1 : 0;
+		if ((f - s) + nf <= 19 && n.end - x <= 5) {
+			uint64_t w = 0;
+			for (; s < f; s++)
+				w = 10*w + (*s - '0');
+			for (s = f + 1; s < x; s++)
+				w = 10*w + (*s - '0');
+			long e10 = 0;
+			if (x < n.end) {
+				bool eneg = x[1] == '-';
+				for (s = x + 1 + (x[1] == '-' || x[1] == '+');
+				     s < n.end; s++)
+					e10 = 10*e10 + (*s - '0');
+				if (eneg)
+					e10 = -e10;
+			}
+			e10 -= nf;
+			if (w <= (uint64_t)1 << std::numeric_limits<T>::digits &&
+			    -max_p10 <= e10 && e10 <= max_p10) {
+				T v = (T)w;
+				v = e10 < 0 ? v / (T)p10[-e10] : v * (T)p10[e10];
+				r = neg ? -v : v;
+				return true;
+			}
+		}
+		auto [p,ec] = std::from_chars(n.integer, n.end, r);
+		return ec == std::errc() && p == n.end;
+	}
+}
+
+static constexpr uint64_t pow10_u64[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL,
+};
+
+inline int n_digits(uint64_t c)
+{
+	int d = 1;
+	while (d < 20 && c >= pow10_u64[d])
+		d++;
+	return d;
+}
+
+}
+
+/* Exact decimal number (-1)^negative * coefficient * 10^exponent as written in
+ * the document, i.e., 1.50 is 150e-2, which preserves the scale.  The
+ * coefficient consists of all digits before and after the decimal point,
+ * trailing zeros included, so 1e20 converts while 100000000000000000000.0
+ * does not.  Numbers whose coefficient exceeds UINT64_MAX, which holds for
+ * some 20 and all longer digit sequences, or whose exponent does not fit into
+ * int32_t fail to convert with error::PARSE_NUMBER. */
+struct decimal {
+	uint64_t coefficient = 0;
+	int32_t exponent = 0;
+	bool negative = false;
+
+	/* upper bound on the length of to_chars()' output */
+	static constexpr size_t max_chars = 40;
+
+	/* Compares the values of a and b, returning -1, 0 or 1. */
+	static int compare(const decimal &a, const decimal &b)
+	{
+		bool na = a.negative && a.coefficient;
+		bool nb = b.negative && b.coefficient;
+		if (na != nb)
+			return na ? -1 : 1;
+		int s = na ? -1 : 1;
+		if (!a.coefficient || !b.coefficient)
+			return (a.coefficient != 0) - (b.coefficient != 0);
+		/* compare orders of magnitude, then the coefficients aligned
+		 * to the smaller exponent */
+		int64_t ma = (int64_t)a.exponent + detail::n_digits(a.coefficient);
+		int64_t mb = (int64_t)b.exponent + detail::n_digits(b.coefficient);
+		if (ma != mb)
+			return ma < mb ? -s : s;
+		const decimal &hi = a.exponent >= b.exponent ? a : b;
+		const decimal &lo = a.exponent >= b.exponent ? b : a;
+		uint64_t p = detail::pow10_u64[hi.exponent - lo.exponent];
+		uint64_t q = lo.coefficient / p, r = lo.coefficient % p;
+		int c = hi.coefficient != q ? hi.coefficient < q ? -1 : 1
+		                            : r ? -1 : 0;
+		return (&hi == &a ? c : -c) * s;
+	}
+
+	friend bool operator==(const decimal &a, const decimal &b) { return compare(a, b) == 0; }
+	friend bool operator!=(const decimal &a, const decimal &b) { return compare(a, b) != 0; }
+	friend bool operator< (const decimal &a, const decimal &b) { return compare(a, b) <  0; }
+	friend bool operator<=(const decimal &a, const decimal &b) { return compare(a, b) <= 0; }
+	friend bool operator> (const decimal &a, const decimal &b) { return compare(a, b) >  0; }
+	friend bool operator>=(const decimal &a, const decimal &b) { return compare(a, b) >= 0; }
+
+	/* Formats the number like the to-scientific-string operation of the
+	 * General Decimal Arithmetic specification, e.g., 150e-2 as "1.50" and
+	 * 15e3 as "1.5e+4"; the result is a valid JSON number. */
+	std::to_chars_result to_chars(char *first, char *last) const
+	{
+		char digits[20];
+		auto [d_end,ec] = std::to_chars(digits, digits + sizeof(digits),
+		                                coefficient);
+		int n = d_end - digits;
+		int64_t adjusted = (int64_t)exponent + n - 1;
+		char buf[max_chars], *w = buf;
+		if (negative)
+			*w++ = '-';
+		if (exponent <= 0 && adjusted >= -6) {
+			int64_t i = n + (int64_t)exponent;
+			if (i <= 0) {
+				*w++ = '0';
+				*w++ = '.';
+				for (; i < 0; i++)
+					*w++ = '0';
+				w = std::copy(digits, d_end, w);
+			} else {
+				w = std::copy(digits, digits + i, w);
+				if (i < n) {
+					*w++ = '.';
+					w = std::copy(digits + i, d_end, w);
+				}
+			}
+		} else {
+			*w++ = digits[0];
+			if (n > 1) {
+				*w++ = '.';
+				w = std::copy(digits + 1, d_end, w);
+			}
+			*w++ = 'e';
+			*w++ = adjusted < 0 ? '-' : '+';
+			w = std::to_chars(w, buf + sizeof(buf),
+			                  adjusted < 0 ? -adjusted : adjusted).ptr;
+		}
+		if (last - first < w - buf)
+			return { last, std::errc::value_too_large };
+		return { std::copy(buf, w, first), std::errc() };
+	}
+
+	friend std::ostream & operator<<(std::ostream &os, const decimal &d)
+	{
+		char buf[max_chars];
+		return os.write(buf, d.to_chars(buf, buf + sizeof(buf)).ptr - buf);
+	}
+};
+
+template <> struct requests_number<decimal> : std::true_type {};
+
+namespace detail {
+
+template <> struct builtin_number<decimal> : std::true_type {};
+
+inline bool read_number(const ::kjson_number &n, decimal &r)
+{
+	const char *s = n.integer;
+	r.negative = *s == '-';
+	s += r.negative;
+	uint64_t c = 0;
+	int64_t e = 0;
+	for (; s < n.exponent; s++) {
+		if (*s == '.') {
+			e = -(n.exponent - s - 1);
+			continue;
+		}
+		unsigned d = *s - '0';
+		if (c >= UINT64_MAX / 10 &&
+		    (c > UINT64_MAX / 10 || d > UINT64_MAX % 10))
+			return false;
+		c = 10*c + d;
+	}
+	if (s < n.end) {
+		bool eneg = s[1] == '-';
+		int64_t x = 0;
+		for (s += 1 + (s[1] == '-' || s[1] == '+'); s < n.end; s++)
+			if ((x = 10*x + (*s - '0')) > INT32_MAX)
+				return false;
+		e += eneg ? -x : x;
+	}
+	if (e < INT32_MIN || e > INT32_MAX)
+		return false;
+	r.coefficient = c;
+	r.exponent = (int32_t)e;
+	return true;
+}
+
+}
+
 enum class error : int {
 	PARSE_JSON = 1,
 	NOT_NULL,
@@ -149,6 +622,7 @@ enum class error : int {
 	KEY_NOT_FOUND,
 	INDEX_OUT_OF_BOUNDS,
 	PARSE_NUMBER,
+	PARSE_BASE64,
 };
 
 static const char *const error_messages[] = {
@@ -164,6 +638,7 @@ static const char *const error_messages[] = {
 	"key not found",
 	"index out of bounds",
 	"number parse error",
+	"base64 decode error",
 };
 
 template <typename Opt>
@@ -175,23 +650,28 @@ class kjson_impl {
 	static opt_t<kjson_impl<Opt>> parse(
 		std::shared_ptr<detail::base<T>> ptr
 	) {
-		::kjson_parser p { ptr->data() };
+		::kjson_parser p {};
+		p.s = ptr->data();
 		::kjson_value *v = ptr.get();
 		if (!kjson_parse(&p, v))
 			return Opt::template none<kjson_impl<Opt>>(error::PARSE_JSON);
 		return Opt::some(kjson_impl<Opt> { std::move(ptr), v });
 	}
 
+	friend class object_reader<Opt>;
+	friend class detail::arr_itr<Opt>;
+
 protected:
-	std::shared_ptr<const ::kjson_value> b;
+	std::shared_ptr<const detail::doc> b;
 	const ::kjson_value *v;
 
-	kjson_impl(const std::shared_ptr<const ::kjson_value> &b,
+	kjson_impl(const std::shared_ptr<const detail::doc> &b,
 	           const ::kjson_value *v)
 	: b(b)
 	, v(v)
 	{}
 
+
 public:
 	static opt_t<kjson_impl<Opt>> parse(char *s)
 	{
@@ -234,6 +714,8 @@ public:
 	{
 		if (v->type != KJSON_VALUE_OBJECT)
 			return Opt::template none<bool>(error::NOT_AN_OBJECT);
+		if (v->o.n >= detail::index_table::MIN_KEYS)
+			return Opt::some(b->index(v->o).find(sv) != v->o.n);
 		for (size_t i=0; i < v->o.n; i++)
 			if (sv.length() == v->o.data[i].key.len &&
 			    !memcmp(sv.data(), v->o.data[i].key.begin,
@@ -260,6 +742,14 @@ public:
 	{
 		if (v->type != KJSON_VALUE_OBJECT)
 			return Opt::template none<kjson_impl<Opt>>(error::NOT_AN_OBJECT);
+		if (v->o.n >= detail::index_table::MIN_KEYS) {
+			size_t i = b->index(v->o).find(sv);
+			if (i < v->o.n)
+				return Opt::some(kjson_impl<Opt> { b, &v->o.data[i].value });
+			return Opt::template none<kjson_impl<Opt>>(
+				i == v->o.n ? error::KEY_NOT_FOUND
+				            : error::KEY_NOT_UNIQUE);
+		}
 		::kjson_value *found = nullptr;
 		for (size_t i=0; i < v->o.n; i++)
 			if (sv.length() == v->o.data[i].key.len &&
@@ -273,6 +763,13 @@ public:
 		return Opt::template none<kjson_impl<Opt>>(error::KEY_NOT_FOUND);
 	}
 
+	opt_t<object_reader<Opt>> reader() const
+	{
+		if (v->type != KJSON_VALUE_OBJECT)
+			return Opt::template none<object_reader<Opt>>(error::NOT_AN_OBJECT);
+		return Opt::some(object_reader<Opt> { *this });
+	}
+
 	opt_t<size_t> size() const
 	{
 		if (v->type != KJSON_VALUE_ARRAY)
@@ -303,6 +800,20 @@ public:
 		return Opt::some(detail::arr_itr<Opt> { b, &v->a.data[v->a.n] });
 	}
 
+	/* The elements as range whose iterators do not own the document, see
+	 * detail::arr_range. */
+	opt_t<detail::arr_range<Opt>> borrowed() const
+	{
+		if (v->type != KJSON_VALUE_ARRAY)
+			return Opt::template none<detail::arr_range<Opt>>(error::NOT_A_LIST);
+		/* a pointer to the document not owning it */
+		std::shared_ptr<const detail::doc> p { std::shared_ptr<const detail::doc>(), b.get() };
+		return Opt::some(detail::arr_range<Opt> {
+			detail::arr_itr<Opt> { p, &v->a.data[0] },
+			detail::arr_itr<Opt> { p, &v->a.data[v->a.n] },
+		});
+	}
+
 	friend auto begin(const kjson_impl &a) { return a.begin(); }
 	friend auto end  (const kjson_impl &a) { return a.end(); }
 
@@ -313,6 +824,22 @@ public:
 		return Opt::some(std::string_view { v->s.begin, v->s.len });
 	}
 
+	/* Decodes the base64-encoded string into out, which has to provide
+	 * space for at least as many bytes as the string is long, and returns
+	 * the number of decoded bytes.  Unlike kjson_read_string_base64(), this
+	 * copies: the document is shared by all copies of this object and
+	 * possibly read concurrently, so it is not overwritten.  out may be
+	 * partly written on failure. */
+	opt_t<size_t> get_base64(char *out) const
+	{
+		if (v->type != KJSON_VALUE_STRING)
+			return Opt::template none<size_t>(error::NOT_A_STRING);
+		size_t n;
+		if (!kjson_base64_decode(out, v->s.begin, v->s.len, &n))
+			return Opt::template none<size_t>(error::PARSE_BASE64);
+		return Opt::some(n);
+	}
+
 	opt_t<std::string_view> get_number_rep() const
 	{
 		if (v->type != KJSON_VALUE_NUMBER)
@@ -372,19 +899,67 @@ public:
 	template <typename T>
 	std::enable_if_t<requests_number<T>::value,opt_t<T>> get() const
 	{
-		return Opt::bind(get_number_rep(), [](auto x){
-			using std::from_chars;
+		if constexpr (detail::builtin_number<T>::value) {
+			if (v->type != KJSON_VALUE_NUMBER)
+				return Opt::template none<T>(error::NOT_A_NUMBER);
 			T r;
-			const char *end = x.data() + x.length();
-			if (auto [p,ec] = from_chars(x.data(), end, r);
-			    ec != std::errc() || p != end)
+			if (!detail::read_number(v->n, r))
 				return Opt::template none<T>(error::PARSE_NUMBER);
-			return Opt::some(std::move(r));
-		});
+			return Opt::some(r);
+		} else {
+			return Opt::bind(get_number_rep(), [](auto x){
+				using std::from_chars;
+				T r;
+				const char *end = x.data() + x.length();
+				if (auto [p,ec] = from_chars(x.data(), end, r);
+				    ec != std::errc() || p != end)
+					return Opt::template none<T>(error::PARSE_NUMBER);
+				return Opt::some(std::move(r));
+			});
+		}
+	}
+};
+
+/* Looks up keys in a single object assuming they are requested in the order
+ * they appear in the document: each search starts just after the previous hit
+ * and wraps around at the end, which makes in-order access O(1) amortized per
+ * key.  In contrast to kjson_impl::operator[], keys are not checked for
+ * uniqueness, the next match is returned. */
+template <typename Opt>
+class object_reader {
+
+	template <typename R> using opt_t = typename Opt::template type<R>;
+
+	kjson_impl<Opt> o;
+	size_t pos = 0;
+
+	friend class kjson_impl<Opt>;
+
+	object_reader(const kjson_impl<Opt> &o) : o(o) {}
+
+public:
+	opt_t<kjson_impl<Opt>> operator[](std::string_view sv)
+	{
+		const ::kjson_object &obj = o.v->o;
+		for (size_t k=0, i=pos; k < obj.n; k++, i++) {
+			if (i == obj.n)
+				i = 0;
+			if (sv.length() == obj.data[i].key.len &&
+			    !memcmp(sv.data(), obj.data[i].key.begin, sv.length())) {
+				pos = i+1 < obj.n ? i+1 : 0;
+				return Opt::some(kjson_impl<Opt> { o.b, &obj.data[i].value });
+			}
+		}
+		return Opt::template none<kjson_impl<Opt>>(error::KEY_NOT_FOUND);
 	}
 };
 
 namespace detail {
+/* Random-access iterator over the elements of a JSON array.  Dereferencing
+ * yields a kjson_impl by value, so like std::vector<bool>::iterator it is a
+ * proxy iterator; it satisfies std::random_access_iterator in C++20.  The
+ * values share the iterator's reference to the document, which is owning
+ * unless it comes from an arr_range. */
 template <typename Opt>
 class arr_itr : kjson_impl<Opt> {
 
@@ -392,6 +967,15 @@ class arr_itr : kjson_impl<Opt> {
 	friend class kjson_impl<Opt>;
 
 public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef std::random_access_iterator_tag iterator_concept;
+	typedef kjson_impl<Opt>                 value_type;
+	typedef ptrdiff_t                       difference_type;
+	typedef kjson_impl<Opt>                 reference;
+	typedef const kjson_impl<Opt> *         pointer;
+
+	arr_itr() : kjson_impl<Opt>({}, nullptr) {}
+
 	arr_itr & operator++()
 	{
 		++this->v;
@@ -402,30 +986,152 @@ public:
 		--this->v;
 		return *this;
 	}
+	arr_itr operator++(int) { arr_itr r = *this; ++this->v; return r; }
+	arr_itr operator--(int) { arr_itr r = *this; --this->v; return r; }
+
+	arr_itr & operator+=(ptrdiff_t n)
+	{
+		this->v += n;
+		return *this;
+	}
+	arr_itr & operator-=(ptrdiff_t n)
+	{
+		this->v -= n;
+		return *this;
+	}
+
+	friend arr_itr operator+(arr_itr a, ptrdiff_t n) { return a += n; }
+	friend arr_itr operator+(ptrdiff_t n, arr_itr a) { return a += n; }
+	friend arr_itr operator-(arr_itr a, ptrdiff_t n) { return a -= n; }
 
 	friend ptrdiff_t operator-(const arr_itr &a, const arr_itr &b)
 	{
 		return a.v - b.v;
 	}
 
-	const kjson_impl<Opt> & operator*() const { return *this; }
+	kjson_impl<Opt> operator*() const { return *this; }
 	const kjson_impl<Opt> * operator->() const { return this; }
-
-	friend bool operator==(const arr_itr &a, const arr_itr &b)
+	kjson_impl<Opt> operator[](ptrdiff_t n) const
 	{
-		return a.b == b.b && a.v == b.v;
+		return kjson_impl<Opt> { this->b, this->v + n };
 	}
 
-	friend bool operator!=(const arr_itr &a, const arr_itr &b)
+	/* iterators into the same array share the document, comparing the
+	 * element pointers suffices */
+	friend bool operator==(const arr_itr &a, const arr_itr &b) { return a.v == b.v; }
+	friend bool operator!=(const arr_itr &a, const arr_itr &b) { return a.v != b.v; }
+	friend bool operator< (const arr_itr &a, const arr_itr &b) { return a.v <  b.v; }
+	friend bool operator<=(const arr_itr &a, const arr_itr &b) { return a.v <= b.v; }
+	friend bool operator> (const arr_itr &a, const arr_itr &b) { return a.v >  b.v; }
+	friend bool operator>=(const arr_itr &a, const arr_itr &b) { return a.v >= b.v; }
+};
+
+/* Elements of a JSON array as returned by kjson_impl::borrowed().  Neither
+ * its iterators nor the values obtained from them own the document, so that
+ * copying them, as parallel algorithms do all the time, needs no atomic
+ * reference counting. */
+template <typename Opt>
+class arr_range {
+
+	arr_itr<Opt> first, last;
+
+	arr_range(arr_itr<Opt> first, arr_itr<Opt> last)
+	: first(first)
+	, last(last)
+	{}
+
+	friend class kjson_impl<Opt>;
+
+public:
+	arr_itr<Opt> begin() const { return first; }
+	arr_itr<Opt> end() const { return last; }
+	size_t size() const { return last - first; }
+};
+}
+
+/* Result of kjson::json_exp operations: either a value or the error that
+ * prevented it.  This is std::expected<T,error> when available, otherwise a
+ * small stand-in providing the commonly used part of its interface. */
+#ifdef __cpp_lib_expected
+template <typename T> using expected = std::expected<T,error>;
+using std::unexpected;
+#else
+class unexpected {
+	kjson::error e;
+public:
+	constexpr explicit unexpected(kjson::error e) : e(e) {}
+	constexpr kjson::error error() const { return e; }
+};
+
+template <typename T>
+class expected {
+	std::optional<T> v;
+	kjson::error e = {};
+public:
+	typedef T value_type;
+	typedef kjson::error error_type;
+
+	expected(const T &v) : v(v) {}
+	expected(T &&v) : v(std::move(v)) {}
+	expected(const unexpected &u) : e(u.error()) {}
+
+	bool has_value() const { return v.has_value(); }
+	explicit operator bool() const { return v.has_value(); }
+
+	const T & operator*() const & { return *v; }
+	T & operator*() & { return *v; }
+	T && operator*() && { return *std::move(v); }
+	const T * operator->() const { return &*v; }
+	T * operator->() { return &*v; }
+
+	const T & value() const & { return v.value(); }
+	T && value() && { return std::move(v).value(); }
+	template <typename U> T value_or(U &&d) const &
 	{
-		return !(a == b);
+		return v.value_or(std::forward<U>(d));
 	}
+
+	kjson::error error() const { return e; }
 };
-}
+#endif
 
 namespace detail {
 
-/* 2 monads, based on std::optional and throw */
+/* 3 monads, based on std::optional, expected and throw */
+
+struct opt_expected {
+
+	template <typename R> using type = expected<R>;
+	template <typename R> static expected<R> none(error e) { return unexpected(e); }
+	template <typename R> static expected<R> some(const R &v) { return { v }; }
+
+	template <typename F, typename T>
+	static type<std::invoke_result_t<F,T &&>> bind(expected<T> &&a, F &&f)
+	{
+		if (a)
+			return std::forward<F>(f)(std::move(*a));
+		else
+			return unexpected(a.error());
+	}
+
+	template <typename F, typename T>
+	static type<std::invoke_result_t<F,const T &>> bind(const expected<T> &a, F &&f)
+	{
+		if (a)
+			return std::forward<F>(f)(*a);
+		else
+			return unexpected(a.error());
+	}
+
+	template <typename F, typename T>
+	static type<std::invoke_result_t<F,T &&>> fmap(F &&f, expected<T> &&x)
+	{
+		if (x)
+			return some(std::forward<F>(f)(std::move(*x)));
+		else
+			return unexpected(x.error());
+	}
+};
 
 template <template <typename> typename O>
 struct opt_ctor {
@@ -506,12 +1212,14 @@ typedef kjson_impl<detail::opt_ctor<std::optional>> json_opt;
 
 typedef kjson_impl<detail::opt_throw> json;
 
-}
+/* like json_opt, but keeps the error code and never throws */
+typedef kjson_impl<detail::opt_expected> json_exp;
 
-namespace std {
-template <typename Opt>
-struct iterator_traits<kjson::detail::arr_itr<Opt>>
-: iterator_traits<const ::kjson_value *> {};
 }
 
+#ifdef __cpp_lib_concepts
+static_assert(std::random_access_iterator<kjson::detail::arr_itr<kjson::detail::opt_throw>>);
+static_assert(std::ranges::random_access_range<kjson::json>);
+#endif
+
 #endif
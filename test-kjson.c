@@ -6,6 +6,7 @@
 #include <assert.h>	/* assert(3) */
 #include <stdlib.h>	/* exit(3), free(3) */
 #include <inttypes.h>	/* PRIdMAX */
+#include <errno.h>	/* errno(3) */
 
 #include "kjson.h"
 
@@ -19,6 +20,7 @@ static void dbg_leaf(const struct kjson_mid_cb *c, enum kjson_leaf_type type,
 	case KJSON_LEAF_BOOLEAN: printf("%s\n", l->b ? "true" : "false"); break;
 	case KJSON_LEAF_NUMBER: printf("%.*s\n", (int)(l->n.end - l->n.integer), l->n.integer); break;
 	case KJSON_LEAF_STRING:
+	case KJSON_LEAF_STRING_ESCAPED:
 		printf("\"%.*s\"\n", (int)l->s.len, l->s.begin);
 		break;
 	}
@@ -78,7 +80,7 @@ static const struct kjson_mid_cb null_cb = {
 static bool high_v(struct kjson_parser *p, const struct kjson_mid_cb *cb)
 {
 	(void)cb;
-	struct kjson_value v;
+	struct kjson_value v = KJSON_VALUE_INIT;
 	bool r = kjson_parse(p, &v);
 	kjson_value_print(stdout, &v);
 	printf("\n");
@@ -89,17 +91,65 @@ static bool high_v(struct kjson_parser *p, const struct kjson_mid_cb *cb)
 static bool high(struct kjson_parser *p, const struct kjson_mid_cb *cb)
 {
 	(void)cb;
-	struct kjson_value v;
+	struct kjson_value v = KJSON_VALUE_INIT;
 	bool r = kjson_parse(p, &v);
 	kjson_value_fini(&v);
 	return r;
 }
 
-#include <string.h>		/* memcpy() */
+#include <string.h>		/* memcpy(), strlen() */
 #include <sys/time.h>		/* gettimeofday() */
 
 #define MAX(a,b)	((a) > (b) ? (a) : (b))
 
+static unsigned parse_flags;
+
+/* set when the input consists of concatenated documents (option -c) */
+static bool many;
+/* set when NDJSON is read by kjson_parse_fd() (option -p) */
+static bool pipelined;
+
+static bool validate(struct kjson_parser *p, const struct kjson_mid_cb *cb)
+{
+	(void)cb;
+	char *s = p->s;
+	size_t len, off;
+	/* the document ends where kjson_skip() stops, what follows is checked
+	 * by the caller */
+	if (many || pipelined) {
+		if (!kjson_skip(p))
+			return false;
+		len = p->s - s;
+	} else
+		len = strlen(s);
+	if (kjson_validate_err(s, len, false, &p->error, &off))
+		return true;
+	p->error_at = s + off;
+	return false;
+}
+
+struct many_ctx {
+	struct kjson_many_cb parent;
+	bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *);
+	const struct kjson_mid_cb *cb;
+	/* kind and offset of the error in the failed document */
+	enum kjson_error error;
+	size_t error_off;
+};
+
+static bool many_doc(const struct kjson_many_cb *c, struct kjson_parser *p,
+                     size_t idx)
+{
+	(void)idx;
+	struct many_ctx *ctx = (struct many_ctx *)c;
+	const char *s = p->s;
+	if (ctx->parse_f(p, ctx->cb))
+		return true;
+	ctx->error = p->error;
+	ctx->error_off = p->error_at - s;
+	return false;
+}
+
 static void run_single(FILE *f, char **data, size_t *data_cap,
                        bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *),
                        const struct kjson_mid_cb *cb)
@@ -108,8 +158,8 @@ static void run_single(FILE *f, char **data, size_t *data_cap,
 	static char buf[4096];
 	for (size_t rd; (rd = fread(buf, 1, sizeof(buf), f)) > 0;) {
 		size_t n = data_sz + rd;
-		if (n > *data_cap) {
-			*data = realloc(*data, *data_cap = MAX(n, 2 * *data_cap));
+		if (n + 1 > *data_cap) {
+			*data = realloc(*data, *data_cap = MAX(n + 1, 2 * *data_cap));
 			assert(*data);
 		}
 		memcpy(*data + data_sz, buf, rd);
@@ -118,13 +168,32 @@ static void run_single(FILE *f, char **data, size_t *data_cap,
 			break;
 	}
 	assert(feof(f));
-	struct kjson_parser p = { *data };
+	(*data)[data_sz] = '\0';
+	struct kjson_parser p = { .s = *data, .flags = parse_flags };
 	struct timeval tv, tw;
 	gettimeofday(&tv, NULL);
-	bool r = parse_f(&p, cb);
+	bool r;
+	size_t n;
+	if (many) {
+		struct many_ctx ctx = {
+			.parent = { .doc = many_doc },
+			.parse_f = parse_f,
+			.cb = cb,
+		};
+		r = kjson_parse_many(*data, data_sz, &ctx.parent, parse_flags,
+		                     &n);
+		if (r)
+			fprintf(stderr, "documents: %zu\n", n);
+	} else
+		r = parse_f(&p, cb);
 	gettimeofday(&tw, NULL);
-	assert(r);
-	(void)r;
+	if (!r && many)
+		DIE(1,"error in document %zu\n", n);
+	if (!r && p.error != KJSON_ERR_NONE)
+		DIE(1,"error at offset %td: %s\n", p.error_at - *data,
+		    kjson_strerror(p.error));
+	if (!r)
+		DIE(1,"error\n");
 	fprintf(stderr, "time: %luµs\n",
 	        (tw.tv_sec - tv.tv_sec) * 1000000 + (tw.tv_usec - tv.tv_usec));
 }
@@ -134,34 +203,113 @@ static void run_lines(FILE *f, char **data, size_t *data_cap,
                       const struct kjson_mid_cb *cb)
 {
 	for (int n=0; getline(data, data_cap, f) > 0; n++) {
-		struct kjson_parser p = { *data };
-		bool r = parse_f(&p, cb);
-		assert(r);
-		(void)r;
+		struct kjson_parser p = { .s = *data, .flags = parse_flags };
+		if (parse_f(&p, cb))
+			continue;
+		if (p.error == KJSON_ERR_NONE)
+			DIE(1,"error in line %d\n", n + 1);
+		DIE(1,"error in line %d at offset %td: %s\n", n + 1,
+		    p.error_at - *data, kjson_strerror(p.error));
 	}
 }
 
+static void run_fd(FILE *f, char **data, size_t *data_cap,
+                   bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *),
+                   const struct kjson_mid_cb *cb)
+{
+	(void)data;
+	(void)data_cap;
+	struct many_ctx ctx = {
+		.parent = { .doc = many_doc },
+		.parse_f = parse_f,
+		.cb = cb,
+	};
+	size_t n;
+	if (kjson_parse_fd(fileno(f), &ctx.parent, parse_flags, &n))
+		return;
+	if (errno)
+		DIE(1,"error reading line %zu: %s\n", n + 1, strerror(errno));
+	if (ctx.error == KJSON_ERR_NONE)
+		DIE(1,"error in line %zu\n", n + 1);
+	DIE(1,"error in line %zu at offset %zu: %s\n", n + 1, ctx.error_off,
+	    kjson_strerror(ctx.error));
+}
+
+struct batch_ctx {
+	struct kjson_batch_cb parent;
+	bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *);
+	const struct kjson_mid_cb *cb;
+};
+
+static bool batch_file(const struct kjson_batch_cb *c, struct kjson_parser *p,
+                       size_t len, struct kjson_batch_file *f, void *ctx)
+{
+	(void)len;
+	(void)f;
+	(void)ctx;
+	const struct batch_ctx *b = (const struct batch_ctx *)c;
+	p->flags = parse_flags;
+	return b->parse_f(p, b->cb);
+}
+
+static void run_batch(char **paths, int n, unsigned nthreads,
+                      bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *),
+                      const struct kjson_mid_cb *cb)
+{
+	struct kjson_batch_file *files = NULL;
+	size_t n_files = 0;
+	for (int i=0; i<n; i++)
+		if (!kjson_batch_collect(paths[i], &files, &n_files))
+			DIE(1,"error collecting '%s': %s\n", paths[i],
+			    strerror(errno));
+	struct batch_ctx ctx = { { .file = batch_file }, parse_f, cb };
+	struct kjson_batch_stats st;
+	if (!kjson_batch(files, n_files, &ctx.parent, nthreads, &st))
+		DIE(1,"error: out of memory\n");
+	for (size_t i=0; i<n_files; i++)
+		if (!files[i].ok)
+			fprintf(stderr, "%s: %s\n", files[i].path,
+			        files[i].err ? strerror(files[i].err)
+			                     : "parse error");
+	fprintf(stderr, "files: %zu, failed: %zu, %zu bytes in %gs, %g MB/s\n",
+	        st.files, st.failed, st.bytes, st.seconds,
+	        st.bytes / st.seconds / 1e6);
+	kjson_batch_free(files, n_files);
+	if (st.failed)
+		exit(1);
+}
+
 int main(int argc, char **argv)
 {
 	int mid_cb = 0;
 	int verbosity = 0;
 	bool single_doc = false;
+	bool validate_only = false;
+	bool batch = false;
+	unsigned nthreads = 0;
 	size_t buf_sz = 4096;
-	for (int opt; (opt = getopt(argc, argv, ":1b:hm:v")) != -1;)
+	for (int opt; (opt = getopt(argc, argv, ":1b:Bchj:m:prvV")) != -1;)
 		switch (opt) {
 		case '1': single_doc = true; break;
+		case 'B': batch = true; break;
+		case 'c': many = true; break;
 		case 'b':
 			if (sscanf(optarg, "%zu", &buf_sz) < 1 || !buf_sz)
 				DIE(1,"cannot parse parameter to '-b' as size\n");
 			break;
-		case 'h': DIE(1,"usage: %s [-1] [ -m { 1 | 2 } | -v ] [FILES...]\n", argv[0]);
+		case 'h': DIE(1,"usage: %s [-1 [-c] | -p | -B [-j THREADS]] [-r] [ -m { 1 | 2 } | -v | -V ] [FILES...]\n", argv[0]);
+		case 'j': nthreads = atoi(optarg); break;
 		case 'm': mid_cb = atoi(optarg); break;
+		case 'p': pipelined = true; break;
+		case 'r': parse_flags |= KJSON_PARSE_RAW_STRINGS; break;
 		case 'v': verbosity++; break;
+		case 'V': validate_only = true; break;
 		case ':': DIE(1,"error: option '-%c' requires a parameter\n",
 			        optopt);
 		case '?': DIE(1,"error: unknown option '-%c'\n", optopt);
 		}
 	bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *) =
+		validate_only ? validate :
 		mid_cb == 1 ? kjson_parse_mid_rec :
 		mid_cb == 2 ? kjson_parse_mid :
 		verbosity ? high_v : high;
@@ -169,7 +317,11 @@ int main(int argc, char **argv)
 	void (*run)(FILE *f, char **data, size_t *data_cap,
 	            bool (*parse_f)(struct kjson_parser *, const struct kjson_mid_cb *),
 	            const struct kjson_mid_cb *cb)
-		= single_doc ? run_single : run_lines;
+		= single_doc ? run_single : pipelined ? run_fd : run_lines;
+	if (batch) {
+		run_batch(argv + optind, argc - optind, nthreads, parse_f, cb);
+		return 0;
+	}
 	size_t data_cap = buf_sz;
 	char *data = malloc(data_cap);
 	if (optind < argc)